@@ -0,0 +1,153 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Benchmark harness: timing, report output and the entry point.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "bench.h"
+
+#define BENCH_REPORT_VERSION    1
+
+#ifdef XMEM_HOST
+
+#include <time.h>
+
+#define BENCH_UNIT  "ns"
+
+void bench_init (void) {
+    xmem_host_reset();
+}
+
+uint32_t bench_now (void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+#else
+
+#include <avr/interrupt.h>
+
+#define BENCH_UNIT  "cycles"
+
+#ifndef BENCH_BAUD
+#define BENCH_BAUD  9600UL
+#endif
+
+/* Timer1 runs at F_CPU, this counts its overflows to get 32 bits. */
+static volatile uint16_t _bench_overflows = 0;
+
+ISR(TIMER1_OVF_vect) {
+    _bench_overflows++;
+}
+
+static int _bench_putchar (char c, FILE *stream) {
+    loop_until_bit_is_set(UCSR0A, UDRE0);
+    UDR0 = c;
+
+    return 0;
+}
+
+static FILE _bench_stdout = FDEV_SETUP_STREAM(_bench_putchar, NULL, _FDEV_SETUP_WRITE);
+
+void bench_init (void) {
+    UBRR0 = (F_CPU / 16 / BENCH_BAUD) - 1;
+    UCSR0B = _BV(TXEN0);
+    stdout = &_bench_stdout;
+
+    TCCR1A = 0;
+    TCCR1B = _BV(CS10);
+    TIMSK1 = _BV(TOIE1);
+    sei();
+}
+
+uint32_t bench_now (void) {
+    uint8_t sreg = SREG;
+    uint16_t overflows, ticks;
+
+    cli();
+    ticks = TCNT1;
+    overflows = _bench_overflows;
+
+    /* Overflowed after we disabled interrupts but before we read TCNT1. */
+    if ((TIFR1 & _BV(TOV1)) && ticks < 0x8000) {
+        overflows++;
+    }
+    SREG = sreg;
+
+    return ((uint32_t)overflows << 16) | ticks;
+}
+
+#endif
+
+/* Cost of a bench_now()/bench_elapsed() pair, taken off every measurement. */
+static uint32_t _bench_overhead = 0;
+
+uint32_t bench_elapsed (uint32_t start) {
+    uint32_t elapsed = bench_now() - start;
+
+    return elapsed > _bench_overhead ? elapsed - _bench_overhead : 0;
+}
+
+/**
+ * @docstring
+ * Set the wait states of the whole external memory sector.
+ */
+void bench_set_wait_states (uint8_t ws) {
+    XMCRA = (XMCRA & ~(_BV(SRW11) | _BV(SRW10))) | ((ws & 3) << SRW10);
+}
+
+/**
+ * @docstring
+ * Wait states currently set in XMCRA.
+ */
+uint8_t bench_wait_states (void) {
+    return (XMCRA >> SRW10) & 3;
+}
+
+/**
+ * @docstring
+ * Print one result line. per_op has two decimals.
+ */
+void bench_report (const char *name, const char *region, int8_t bank, uint32_t ops, uint32_t total) {
+    uint32_t per_op = ops ? (uint32_t)(((uint64_t)total * 100) / ops) : 0;
+
+    printf("%s,%s,%d,%u,%lu,%lu,%s,%lu.%02lu\n", name, region, bank, bench_wait_states(),
+           (unsigned long)ops, (unsigned long)total, BENCH_UNIT,
+           (unsigned long)(per_op / 100), (unsigned long)(per_op % 100));
+}
+
+int main (void) {
+    uint32_t start;
+
+    bench_init();
+    xmem_init();
+
+    start = bench_now();
+    _bench_overhead = bench_now() - start;
+
+    printf("# atmega2560-xmem %d banks %lu bytes report %d\n", XMEM_BANKS,
+           (unsigned long)XMEM_TOTAL_MEMORY, BENCH_REPORT_VERSION);
+    printf("name,region,bank,wait_states,ops,total,unit,per_op\n");
+
+    bench_xmem();
+    bench_malloc();
+    bench_far();
+
+    printf("# done\n");
+
+#ifdef XMEM_HOST
+    return EXIT_SUCCESS;
+#else
+    while (1) {}
+#endif
+}
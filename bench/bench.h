@@ -0,0 +1,36 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Benchmark harness. On the MCU (a board or simavr) time is counted in CPU
+ * cycles with Timer1, on the host model in nanoseconds. Results are written
+ * as CSV lines to stdout, which is USART0 on the MCU:
+ *
+ *   name,region,bank,wait_states,ops,total,unit,per_op
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#ifndef XMEM_BENCH_H_INCLUDED
+#define XMEM_BENCH_H_INCLUDED
+
+#include <stdint.h>
+
+/* Regions reported in the second column. */
+#define BENCH_REGION_BANK       "bank"
+#define BENCH_REGION_LOW        "low"
+#define BENCH_REGION_INTERNAL   "internal"
+#define BENCH_REGION_NONE       "-"
+
+void bench_init (void);
+uint32_t bench_now (void);
+uint32_t bench_elapsed (uint32_t start);
+void bench_set_wait_states (uint8_t ws);
+uint8_t bench_wait_states (void);
+void bench_report (const char *name, const char *region, int8_t bank, uint32_t ops, uint32_t total);
+
+/* Suites, one per source file. */
+void bench_xmem (void);
+void bench_malloc (void);
+void bench_far (void);
+
+#endif /* XMEM_BENCH_H_INCLUDED */
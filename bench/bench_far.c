@@ -0,0 +1,156 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Far pointer and cross bank copy benchmarks.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "bench.h"
+
+#define BENCH_COPY_SIZE     4096
+
+/* Internal memory buffer the streams are read into and written from. */
+#define BENCH_STREAM_CHUNK  256
+
+/* Bytes per bank touched by the random cache reads, half the cache overall. */
+#define BENCH_CACHE_SPAN    (XMEM_CACHE_LINES * XMEM_CACHE_LINE_SIZE / 2 / XMEM_BANKS)
+
+static volatile uint32_t _sink;
+
+/**
+ * @docstring
+ * Copy between the first and last banks switching for every byte, then
+ * with xmem_memcpy_far.
+ */
+static void bench_copy (void) {
+    uint8_t *src = XMEM_PTR(0x3000);
+    uint8_t *dst = XMEM_PTR(0x8000);
+    uint8_t last = XMEM_BANKS - 1;
+    uint32_t start, total;
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_COPY_SIZE; i++) {
+        uint8_t b;
+
+        xmem_switch_bank(0);
+        b = src[i];
+        xmem_switch_bank(last);
+        dst[i] = b;
+    }
+    total = bench_elapsed(start);
+    bench_report("copy_per_byte_switch", BENCH_REGION_BANK, -1, BENCH_COPY_SIZE, total);
+
+    start = bench_now();
+    xmem_memcpy_far(last, dst, 0, src, BENCH_COPY_SIZE);
+    total = bench_elapsed(start);
+    bench_report("memcpy_far", BENCH_REGION_BANK, -1, BENCH_COPY_SIZE, total);
+
+    start = bench_now();
+    xmem_memcpy_far(0, dst, 0, src, BENCH_COPY_SIZE);
+    total = bench_elapsed(start);
+    bench_report("memcpy_far_same_bank", BENCH_REGION_BANK, 0, BENCH_COPY_SIZE, total);
+}
+
+void bench_far (void) {
+    uint32_t size = xmem_far_size();
+    uint32_t start, total;
+    xmem_far_t far;
+
+    far = XMEM_FAR_START;
+    start = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        xmem_far_write8(far, (uint8_t)i);
+        far = xmem_far_add(far, 1);
+    }
+    total = bench_elapsed(start);
+    bench_report("far_seq_write8", BENCH_REGION_BANK, -1, size, total);
+
+    far = XMEM_FAR_START;
+    start = bench_now();
+    for (uint32_t i = 0; i < size; i++) {
+        _sink = xmem_far_read8(far);
+        far = xmem_far_add(far, 1);
+    }
+    total = bench_elapsed(start);
+    bench_report("far_seq_read8", BENCH_REGION_BANK, -1, size, total);
+
+    far = XMEM_FAR_START;
+    start = bench_now();
+    for (uint32_t i = 0; i < size / 4; i++) {
+        _sink = xmem_far_read32(far);
+        far = xmem_far_add(far, 4);
+    }
+    total = bench_elapsed(start);
+    bench_report("far_seq_read32", BENCH_REGION_BANK, -1, size / 4, total);
+
+    /* The same walks through a stream, a bank switch per bank. */
+    {
+        struct xmem_stream stream;
+        uint8_t buf[BENCH_STREAM_CHUNK];
+
+        for (uint16_t i = 0; i < sizeof(buf); i++) {
+            buf[i] = i;
+        }
+
+        xmem_stream_open(&stream, XMEM_FAR_START, size);
+        start = bench_now();
+        while (xmem_stream_write(&stream, buf, sizeof(buf)));
+        total = bench_elapsed(start);
+        bench_report("stream_write", BENCH_REGION_BANK, -1, size, total);
+
+        xmem_stream_open(&stream, XMEM_FAR_START, size);
+        start = bench_now();
+        while (xmem_stream_read(&stream, buf, sizeof(buf)));
+        total = bench_elapsed(start);
+        bench_report("stream_read", BENCH_REGION_BANK, -1, size, total);
+        _sink = buf[0];
+    }
+
+    /* Ping-pong between the same offset of the first and last banks. */
+    start = bench_now();
+    for (uint16_t i = 0; i < 256; i++) {
+        _sink = xmem_far_read8(XMEM_FAR(i % XMEM_BANKS, XMEM_PTR(0x4000)));
+    }
+    total = bench_elapsed(start);
+    bench_report("far_read8_alternating", BENCH_REGION_BANK, -1, 256, total);
+
+#if XMEM_CACHE_LINES
+    {
+        struct xmem_cache_stats stats;
+
+        xmem_cache_invalidate();
+        xmem_cache_stats(&stats);
+
+        start = bench_now();
+        for (uint16_t i = 0; i < 256; i++) {
+            _sink = xmem_cache_read8(XMEM_FAR(i % XMEM_BANKS, XMEM_PTR(0x4000)));
+        }
+        total = bench_elapsed(start);
+        bench_report("cache_read8_alternating", BENCH_REGION_BANK, -1, 256, total);
+
+        /* Random words over a working set of half the cache. */
+        start = bench_now();
+        for (uint16_t i = 0, lfsr = 1; i < 1024; i++) {
+            lfsr = XMEM_LFSR(lfsr);
+            _sink = xmem_cache_read16(XMEM_FAR(lfsr % XMEM_BANKS, XMEM_PTR(0x4000 + ((lfsr >> 1) % BENCH_CACHE_SPAN & ~1))));
+        }
+        total = bench_elapsed(start);
+        bench_report("cache_rand_read16", BENCH_REGION_BANK, -1, 1024, total);
+
+        xmem_cache_stats(&stats);
+        printf("# cache %d lines of %d bytes %d ways: %lu hits %lu misses %lu writebacks\n",
+               XMEM_CACHE_LINES, XMEM_CACHE_LINE_SIZE, XMEM_CACHE_WAYS, (unsigned long)stats.hits,
+               (unsigned long)stats.misses, (unsigned long)stats.writebacks);
+    }
+#endif
+
+    bench_copy();
+
+    xmem_switch_bank(0);
+}
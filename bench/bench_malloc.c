@@ -0,0 +1,88 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * xmem_malloc/xmem_free and object pool benchmarks on a fragmented bank.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <stdint.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "bench.h"
+
+#define BENCH_LIVE_BLOCKS   64
+#define BENCH_CHURN         512
+#define BENCH_BATCH         16
+
+void bench_malloc (void) {
+    void *live[BENCH_LIVE_BLOCKS];
+    uint32_t start, malloc_total = 0, free_total = 0;
+    uint16_t lfsr = 1;
+
+    for (uint8_t i = 0; i < BENCH_LIVE_BLOCKS; i++) {
+        lfsr = XMEM_LFSR(lfsr);
+        live[i] = xmem_malloc(0, 4 + (lfsr & 0x1ff));
+    }
+
+    /* Free a batch of random blocks and allocate random sizes in their place. */
+    for (uint16_t round = 0; round < BENCH_CHURN / BENCH_BATCH; round++) {
+        uint8_t first;
+
+        lfsr = XMEM_LFSR(lfsr);
+        first = lfsr % BENCH_LIVE_BLOCKS;
+
+        start = bench_now();
+        for (uint8_t i = 0; i < BENCH_BATCH; i++) {
+            xmem_free(0, live[(first + i * 5) % BENCH_LIVE_BLOCKS]);
+        }
+        free_total += bench_elapsed(start);
+
+        start = bench_now();
+        for (uint8_t i = 0; i < BENCH_BATCH; i++) {
+            live[(first + i * 5) % BENCH_LIVE_BLOCKS] = xmem_malloc(0, 4 + (XMEM_LFSR(lfsr + i) & 0x1ff));
+        }
+        malloc_total += bench_elapsed(start);
+    }
+
+    bench_report("xmem_malloc", BENCH_REGION_BANK, 0, BENCH_CHURN, malloc_total);
+    bench_report("xmem_free", BENCH_REGION_BANK, 0, BENCH_CHURN, free_total);
+
+    for (uint8_t i = 0; i < BENCH_LIVE_BLOCKS; i++) {
+        xmem_free(0, live[i]);
+    }
+
+    /* Same churn on a pool of the biggest size used above. */
+    struct xmem_pool *pool = xmem_pool_create(0, 4 + 0x1ff, BENCH_LIVE_BLOCKS);
+
+    malloc_total = free_total = 0;
+
+    for (uint8_t i = 0; i < BENCH_LIVE_BLOCKS; i++) {
+        live[i] = xmem_pool_alloc(pool);
+    }
+
+    for (uint16_t round = 0; round < BENCH_CHURN / BENCH_BATCH; round++) {
+        uint8_t first;
+
+        lfsr = XMEM_LFSR(lfsr);
+        first = lfsr % BENCH_LIVE_BLOCKS;
+
+        start = bench_now();
+        for (uint8_t i = 0; i < BENCH_BATCH; i++) {
+            xmem_pool_free(pool, live[(first + i * 5) % BENCH_LIVE_BLOCKS]);
+        }
+        free_total += bench_elapsed(start);
+
+        start = bench_now();
+        for (uint8_t i = 0; i < BENCH_BATCH; i++) {
+            live[(first + i * 5) % BENCH_LIVE_BLOCKS] = xmem_pool_alloc(pool);
+        }
+        malloc_total += bench_elapsed(start);
+    }
+
+    bench_report("xmem_pool_alloc", BENCH_REGION_BANK, 0, BENCH_CHURN, malloc_total);
+    bench_report("xmem_pool_free", BENCH_REGION_BANK, 0, BENCH_CHURN, free_total);
+
+    xmem_pool_destroy(pool);
+}
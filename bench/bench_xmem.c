@@ -0,0 +1,219 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Bank switch, heap flip and memory access benchmarks.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "bench.h"
+
+#define BENCH_SWITCHES      256
+#define BENCH_HEAP_FLIPS    256
+#define BENCH_INTERNAL_SIZE 1024
+#define BENCH_LOW_SIZE      8192
+
+static volatile uint8_t _sink;
+static uint8_t _internal[BENCH_INTERNAL_SIZE];
+
+/**
+ * @docstring
+ * Time xmem_switch_bank() between every pair of banks, with the heap in
+ * xmem (heap state is swapped) and with the system heap (pins only).
+ */
+static void bench_switch (void) {
+    uint32_t start, total;
+
+    xmem_set_xmem_heap();
+    xmem_switch_bank(0);
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_SWITCHES; i++) {
+        xmem_switch_bank(i % XMEM_BANKS);
+    }
+    total = bench_elapsed(start);
+    bench_report("switch_bank", BENCH_REGION_NONE, -1, BENCH_SWITCHES, total);
+
+    xmem_switch_bank(0);
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_SWITCHES; i++) {
+        xmem_switch_bank(0);
+    }
+    total = bench_elapsed(start);
+    bench_report("switch_bank_same", BENCH_REGION_NONE, -1, BENCH_SWITCHES, total);
+
+    xmem_switch_bank(0);
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_SWITCHES; i++) {
+        xmem_switch_bank_inline(i % XMEM_BANKS);
+    }
+    total = bench_elapsed(start);
+    bench_report("switch_bank_inline", BENCH_REGION_NONE, -1, BENCH_SWITCHES, total);
+
+    xmem_switch_bank(0);
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_SWITCHES / 2; i++) {
+        XMEM_SWITCH_BANK_CONST(0);
+        XMEM_SWITCH_BANK_CONST(XMEM_BANKS - 1);
+    }
+    total = bench_elapsed(start);
+    bench_report("switch_bank_const", BENCH_REGION_NONE, -1, BENCH_SWITCHES, total);
+
+    xmem_switch_bank(0);
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_SWITCHES / 2; i++) {
+        uint8_t saved = xmem_bank_push();
+
+        xmem_bank_select(XMEM_BANKS - 1);
+        xmem_bank_pop(saved);
+    }
+    total = bench_elapsed(start);
+    bench_report("bank_push_pop", BENCH_REGION_NONE, -1, BENCH_SWITCHES, total);
+
+    xmem_set_system_heap();
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_SWITCHES; i++) {
+        xmem_switch_bank(i % XMEM_BANKS);
+    }
+    total = bench_elapsed(start);
+    bench_report("switch_bank_system_heap", BENCH_REGION_NONE, -1, BENCH_SWITCHES, total);
+
+    xmem_set_xmem_heap();
+    xmem_switch_bank(0);
+}
+
+/**
+ * @docstring
+ * Time a xmem_set_system_heap()/xmem_set_xmem_heap() round trip.
+ */
+static void bench_heap_flip (void) {
+    uint32_t start, total;
+
+    xmem_set_xmem_heap();
+
+    start = bench_now();
+    for (uint16_t i = 0; i < BENCH_HEAP_FLIPS; i++) {
+        xmem_set_system_heap();
+        xmem_set_xmem_heap();
+    }
+    total = bench_elapsed(start);
+    bench_report("heap_flip", BENCH_REGION_NONE, -1, BENCH_HEAP_FLIPS * 2, total);
+}
+
+/**
+ * @docstring
+ * Sequential and LFSR random byte reads and writes over [from, from + len).
+ */
+static void bench_access (const char *region, int8_t bank, volatile uint8_t *from, uint16_t len) {
+    uint32_t start, total;
+    uint16_t lfsr, mask;
+
+    start = bench_now();
+    for (uint16_t i = 0; i < len; i++) {
+        from[i] = (uint8_t)i;
+    }
+    total = bench_elapsed(start);
+    bench_report("seq_write", region, bank, len, total);
+
+    start = bench_now();
+    for (uint16_t i = 0; i < len; i++) {
+        _sink = from[i];
+    }
+    total = bench_elapsed(start);
+    bench_report("seq_read", region, bank, len, total);
+
+    /* Smallest all ones mask covering len, out of range offsets are skipped. */
+    for (mask = 1; mask < len - 1; mask = (mask << 1) | 1)
+        ;
+
+    lfsr = 1;
+    start = bench_now();
+    for (uint16_t i = 0; i < len; i++) {
+        do {
+            lfsr = XMEM_LFSR(lfsr);
+        } while ((lfsr & mask) >= len);
+        from[lfsr & mask] = (uint8_t)i;
+    }
+    total = bench_elapsed(start);
+    bench_report("rand_write", region, bank, len, total);
+
+    lfsr = 1;
+    start = bench_now();
+    for (uint16_t i = 0; i < len; i++) {
+        do {
+            lfsr = XMEM_LFSR(lfsr);
+        } while ((lfsr & mask) >= len);
+        _sink = from[lfsr & mask];
+    }
+    total = bench_elapsed(start);
+    bench_report("rand_read", region, bank, len, total);
+}
+
+/**
+ * @docstring
+ * xmem_fill, xmem_fill_pattern and xmem_verify_pattern over [from, from + len).
+ */
+static void bench_fill (const char *region, uint8_t bank, uint8_t *from, uint16_t len) {
+    uint8_t *to = from + len - 1;
+    uint32_t start, total;
+
+    start = bench_now();
+    xmem_fill(bank, from, to, 0);
+    total = bench_elapsed(start);
+    bench_report("fill", region, bank, len, total);
+
+    start = bench_now();
+    xmem_fill_pattern(bank, from, to, bank + 1);
+    total = bench_elapsed(start);
+    bench_report("fill_pattern", region, bank, len, total);
+
+    start = bench_now();
+    _sink = xmem_verify_pattern(bank, from, to, bank + 1) == NULL;
+    total = bench_elapsed(start);
+    bench_report("verify_pattern", region, bank, len, total);
+}
+
+void bench_xmem (void) {
+    for (uint8_t ws = 0; ws < 4; ws++) {
+        bench_set_wait_states(ws);
+
+        bench_switch();
+        bench_heap_flip();
+
+        /* Internal SRAM is not affected by wait states, it's the baseline. */
+        bench_access(BENCH_REGION_INTERNAL, -1, _internal, BENCH_INTERNAL_SIZE);
+
+        for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+            xmem_switch_bank(bank);
+
+            uint8_t *start = xmem_get_current_bank_address_start();
+            uint8_t *end = xmem_get_current_bank_address_end();
+
+            bench_access(BENCH_REGION_BANK, bank, start, (uint16_t)(end - start));
+            bench_fill(BENCH_REGION_BANK, bank, start, (uint16_t)(end - start));
+        }
+
+        uint8_t *low = xmem_unshadow_lower_memory();
+
+        for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+            xmem_switch_bank(bank);
+            bench_access(BENCH_REGION_LOW, bank, low, BENCH_LOW_SIZE);
+            bench_fill(BENCH_REGION_LOW, bank, low, BENCH_LOW_SIZE);
+        }
+
+        xmem_shadow_lower_memory();
+        xmem_switch_bank(0);
+    }
+
+    bench_set_wait_states(XMEM_WAIT_STATES);
+}
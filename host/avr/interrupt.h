@@ -0,0 +1,22 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Host model of <avr/interrupt.h>. Interrupts are plain functions the host
+ * code calls whenever it wants one to happen, the I bit lives in SREG.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#ifndef XMEM_HOST_AVR_INTERRUPT_H_INCLUDED
+#define XMEM_HOST_AVR_INTERRUPT_H_INCLUDED
+
+#include <avr/io.h>
+
+#define SREG_I  7
+
+#define sei()   (SREG |= _BV(SREG_I))
+#define cli()   (SREG &= ~_BV(SREG_I))
+
+#define ISR(vector_, ...)   void vector_ (void)
+
+#endif /* XMEM_HOST_AVR_INTERRUPT_H_INCLUDED */
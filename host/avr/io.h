@@ -0,0 +1,57 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Host model of <avr/io.h>. Every register lives at its real data space
+ * address inside xmem_host_space, so the library code that writes XMCRA,
+ * XMCRB or the port registers runs unmodified on a regular computer.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#ifndef XMEM_HOST_AVR_IO_H_INCLUDED
+#define XMEM_HOST_AVR_IO_H_INCLUDED
+
+#include <stdint.h>
+
+/* The whole 64KB data space of the Atmega2560: registers, internal SRAM and
+   the external memory window. */
+extern uint8_t xmem_host_space[65536];
+
+#define _SFR_MEM8(addr_)    (*(volatile uint8_t *)&xmem_host_space[(addr_)])
+#define _BV(bit_)           (1 << (bit_))
+
+/* Ports used by the library and the example configurations. */
+#define DDRC    _SFR_MEM8(0x27)
+#define PORTC   _SFR_MEM8(0x28)
+#define DDRD    _SFR_MEM8(0x2A)
+#define PORTD   _SFR_MEM8(0x2B)
+#define DDRL    _SFR_MEM8(0x10A)
+#define PORTL   _SFR_MEM8(0x10B)
+
+/* Status register and stack pointer. */
+#define SPL     _SFR_MEM8(0x5D)
+#define SPH     _SFR_MEM8(0x5E)
+#define SREG    _SFR_MEM8(0x5F)
+
+/* External Memory Control Register A. */
+#define XMCRA   _SFR_MEM8(0x74)
+#define SRW00   0
+#define SRW01   1
+#define SRW10   2
+#define SRW11   3
+#define SRL0    4
+#define SRL1    5
+#define SRL2    6
+#define SRE     7
+
+/* External Memory Control Register B. */
+#define XMCRB   _SFR_MEM8(0x75)
+#define XMM0    0
+#define XMM1    1
+#define XMM2    2
+#define XMBK    7
+
+#define RAMEND  0x21FF
+#define XRAMEND 0xFFFF
+
+#endif /* XMEM_HOST_AVR_IO_H_INCLUDED */
@@ -0,0 +1,65 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Configuration file for the host build. Simulates the Megaram (128KB) shield.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#ifndef CONF_XMEM_H_INCLUDED
+#define CONF_XMEM_H_INCLUDED
+
+#include "xmem-host.h"
+
+/* Total amount of your external ram (bytes). The host build also runs 512KB
+   and 1MB boards. */
+#ifndef XMEM_TOTAL_MEMORY
+#define XMEM_TOTAL_MEMORY  131072
+#endif
+
+#if XMEM_TOTAL_MEMORY > 131072
+
+/* Bigger boards take the bank number on PL0 and up, PL7 stays chip enable. */
+#define XMEM_USER_INIT()                                        \
+    DDRL |= _BV(7) | XMEM_BANK_MASK(0, XMEM_BANK_BITS);         \
+    PORTL = 0xFF;
+
+#define XMEM_USER_SWITCH_BANK(bank_)                            \
+    XMEM_PORT_SELECT_BANK(PORTL, 0, XMEM_BANK_BITS, bank_);     \
+    xmem_host_switch_bank(bank_);
+
+#else
+
+/* Same pins as the Megaram shield, they only end up in the simulated registers. */
+#define XMEM_USER_INIT()                        \
+    DDRD |= _BV(7);                             \
+    PORTD = 0x7F;                               \
+    DDRL |= _BV(7);                             \
+    PORTL = 0xFF;
+
+/* Drive PD7 like the Megaram shield and have the model remap the window. */
+#define XMEM_USER_SWITCH_BANK(bank_)            \
+    XMEM_PORT_SELECT_BANK(PORTD, 7, 1, bank_);  \
+    xmem_host_switch_bank(bank_);
+
+#endif
+
+/* Wait states only matter to the cycle counts, the model ignores them. */
+#define XMEM_WAIT_STATES  0
+
+/* Small two way cache so the tests have something to evict. */
+#define XMEM_CACHE_LINES      16
+#define XMEM_CACHE_LINE_SIZE  16
+#define XMEM_CACHE_WAYS       2
+
+#define XMEM_STATS  1
+
+#define XMEM_HANDLES  8
+
+#define XMEM_LOW_HEAP  1
+
+/* A few small frames so the paging test has something to evict. */
+#define XMEM_VM_FRAMES      4
+#define XMEM_VM_PAGE_SIZE   128
+
+#endif /* CONF_XMEM_H_INCLUDED */
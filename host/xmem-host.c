@@ -0,0 +1,359 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Host memory model.
+ *
+ * The 64KB data space is a plain array. Whatever is mapped into the external
+ * window (0x2200-0xffff) is copied in from the backing chip bank when the
+ * mapping changes, and bytes that changed are written back before the next
+ * remap. That keeps pointer dereferences in the library free of any hooks.
+ * With XMEM_COMMON_END the model has a split decoder that maps the common
+ * region to bank 0 whatever the select lines say.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+
+/* Banks the chip is made of, counting a partial last bank. */
+#define XMEM_HOST_BANKS ((XMEM_TOTAL_MEMORY + 65535UL) / 65536UL)
+
+#if XMEM_HOST_BANKS > XMEM_HOST_MAX_BANKS
+#error "The host model can't back that many banks, raise XMEM_HOST_MAX_BANKS."
+#endif
+
+#define XMEM_HOST_WINDOW_START  0x2200UL
+#define XMEM_HOST_WINDOW_END    0x10000UL
+
+/* Window addresses below this one are the common region, see XMEM_COMMON_END. */
+#define XMEM_HOST_BANKED_START  ((uint32_t)XMEM_BANKED_START)
+
+uint8_t xmem_host_space[65536] __attribute__((aligned(16)));
+
+/* What the window held right after the last remap, to find written bytes. */
+static uint8_t _window_snapshot[65536];
+static uint8_t _chip[XMEM_HOST_BANKS][65536];
+
+static uint8_t _selected_bank = 0;
+static uint8_t _mapped_bank = 0;
+static uint16_t _mapped_mask = 0xffff;
+static uint8_t _chip_wait_states = 0;
+static uint32_t _chip_size = XMEM_HOST_BANKS * 65536UL;
+
+char *__malloc_heap_start = (char *)&xmem_host_space[XMEM_HOST_HEAP_START];
+char *__malloc_heap_end = 0;
+size_t __malloc_margin = 32;
+void *__brkval = 0;
+void *__flp = 0;
+
+/**
+ * @docstring
+ * Address lines that reach the chip given the XMCRB mask bits and the chip
+ * size, the lines above a chip smaller than 64KB are not connected.
+ */
+static uint16_t _xmem_host_address_mask (void) {
+    uint8_t xmm = XMCRB & (_BV(XMM0) | _BV(XMM1) | _BV(XMM2));
+    uint16_t mask = xmm ? (uint16_t)((1UL << (16 - xmm)) - 1) : 0xffff;
+
+    if (_chip_size < 65536UL) {
+        mask &= (uint16_t)(_chip_size - 1);
+    }
+
+    return mask;
+}
+
+/**
+ * @docstring
+ * Wait states XMCRA sets for the sector an address is in.
+ */
+static uint8_t _xmem_host_wait_states (uint32_t addr) {
+    uint8_t srl = (XMCRA >> SRL0) & 7;
+
+    if (srl && addr < (srl + 1) * 0x2000UL) {
+        return (XMCRA >> SRW00) & 3;
+    }
+
+    return (XMCRA >> SRW10) & 3;
+}
+
+/**
+ * @docstring
+ * Chip storage behind a window address, a split decoder sends the common
+ * region to bank 0.
+ */
+static inline uint8_t *_xmem_host_chip_at (uint32_t addr, uint8_t bank) {
+    return addr < XMEM_HOST_BANKED_START ? _chip[0] : _chip[bank];
+}
+
+/**
+ * @docstring
+ * Write back the bytes that changed in the window since the last remap and
+ * load the window with what the current bank and XMCRB mask expose. Bytes
+ * written with fewer wait states than the chip needs get their low bit
+ * flipped.
+ */
+void xmem_host_remap (void) {
+    /* Without aliasing or a slow chip the window is just a copy of the chip. */
+    if (_mapped_mask == 0xffff && !_chip_wait_states) {
+        memcpy(&_chip[0][XMEM_HOST_WINDOW_START], &xmem_host_space[XMEM_HOST_WINDOW_START],
+               XMEM_HOST_BANKED_START - XMEM_HOST_WINDOW_START);
+        memcpy(&_chip[_mapped_bank][XMEM_HOST_BANKED_START], &xmem_host_space[XMEM_HOST_BANKED_START],
+               XMEM_HOST_WINDOW_END - XMEM_HOST_BANKED_START);
+    } else {
+        for (uint32_t a = XMEM_HOST_WINDOW_START; a < XMEM_HOST_WINDOW_END; a++) {
+            if (xmem_host_space[a] != _window_snapshot[a]) {
+                uint8_t value = xmem_host_space[a];
+
+                if (_xmem_host_wait_states(a) < _chip_wait_states) {
+                    value ^= 0x01;
+                }
+                _xmem_host_chip_at(a, _mapped_bank)[a & _mapped_mask] = value;
+            }
+        }
+    }
+
+    /* Select lines past the chip are not connected either. */
+    _mapped_bank = _selected_bank % ((_chip_size + 65535UL) / 65536UL);
+    _mapped_mask = _xmem_host_address_mask();
+
+    if (_mapped_mask == 0xffff) {
+        memcpy(&xmem_host_space[XMEM_HOST_WINDOW_START], &_chip[0][XMEM_HOST_WINDOW_START],
+               XMEM_HOST_BANKED_START - XMEM_HOST_WINDOW_START);
+        memcpy(&xmem_host_space[XMEM_HOST_BANKED_START], &_chip[_mapped_bank][XMEM_HOST_BANKED_START],
+               XMEM_HOST_WINDOW_END - XMEM_HOST_BANKED_START);
+    } else {
+        for (uint32_t a = XMEM_HOST_WINDOW_START; a < XMEM_HOST_WINDOW_END; a++) {
+            xmem_host_space[a] = _xmem_host_chip_at(a, _mapped_bank)[a & _mapped_mask];
+        }
+    }
+
+    memcpy(&_window_snapshot[XMEM_HOST_WINDOW_START], &xmem_host_space[XMEM_HOST_WINDOW_START],
+           XMEM_HOST_WINDOW_END - XMEM_HOST_WINDOW_START);
+}
+
+/**
+ * @docstring
+ * Drive the (simulated) bank select lines. Meant to be called from
+ * XMEM_USER_SWITCH_BANK in the host conf_xmem.h.
+ */
+void xmem_host_switch_bank (uint8_t bank) {
+    if (bank >= XMEM_HOST_BANKS) {
+        bank = XMEM_HOST_BANKS - 1;
+    }
+
+    _selected_bank = bank;
+    xmem_host_remap();
+}
+
+/**
+ * @docstring
+ * Make the chip need at least this many wait states, writes done with fewer
+ * get corrupted.
+ */
+void xmem_host_set_chip_wait_states (uint8_t ws) {
+    _chip_wait_states = ws;
+}
+
+/**
+ * @docstring
+ * Pretend only this many bytes are installed, a power of two from 8KB up or
+ * a multiple of 64KB up to what XMEM_TOTAL_MEMORY backs. Missing address and
+ * bank select lines make the chip alias.
+ */
+void xmem_host_set_chip_size (uint32_t size) {
+    xmem_host_remap();
+    _chip_size = size;
+    xmem_host_remap();
+}
+
+/**
+ * @docstring
+ * Return the bank the select lines are pointing at.
+ */
+uint8_t xmem_host_selected_bank (void) {
+    return _selected_bank;
+}
+
+/**
+ * @docstring
+ * Return the backing storage of a bank. Only consistent with the window
+ * after a remap.
+ */
+uint8_t *xmem_host_chip (uint8_t bank) {
+    return _chip[bank];
+}
+
+/**
+ * @docstring
+ * Power-on state: registers, memory and malloc globals cleared.
+ */
+void xmem_host_reset (void) {
+    memset(xmem_host_space, 0, sizeof(xmem_host_space));
+    memset(_window_snapshot, 0, sizeof(_window_snapshot));
+    memset(_chip, 0, sizeof(_chip));
+
+    _selected_bank = 0;
+    _mapped_bank = 0;
+    _mapped_mask = 0xffff;
+    _chip_wait_states = 0;
+    _chip_size = XMEM_HOST_BANKS * 65536UL;
+
+    __malloc_heap_start = (char *)&xmem_host_space[XMEM_HOST_HEAP_START];
+    __malloc_heap_end = 0;
+    __brkval = 0;
+    __flp = 0;
+}
+
+/** avr-libc compatible allocator *********************************************/
+
+struct __freelist {
+    size_t sz;
+    struct __freelist *nx;
+};
+
+/* Chunks are kept aligned for the host, the AVR does not need it. */
+#define XMEM_HOST_ALIGN(len_)   (((len_) + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1))
+
+/**
+ * @docstring
+ * Same first exact/best fit walk over __flp as avr-libc, falling back to
+ * growing __brkval towards __malloc_heap_end (or the fake stack).
+ */
+void *xmem_host_malloc (size_t len) {
+    struct __freelist *fp1, *fp2, *sfp1 = 0, *sfp2 = 0;
+    char *cp;
+    size_t s, avail;
+
+    if (len < sizeof(struct __freelist) - sizeof(size_t)) {
+        len = sizeof(struct __freelist) - sizeof(size_t);
+    }
+    len = XMEM_HOST_ALIGN(len);
+
+    for (s = 0, fp1 = __flp, fp2 = 0; fp1; fp2 = fp1, fp1 = fp1->nx) {
+        if (fp1->sz < len) {
+            continue;
+        }
+        if (fp1->sz == len) {
+            if (fp2) {
+                fp2->nx = fp1->nx;
+            } else {
+                __flp = fp1->nx;
+            }
+            return &fp1->nx;
+        }
+        if (s == 0 || fp1->sz < s) {
+            s = fp1->sz;
+            sfp1 = fp1;
+            sfp2 = fp2;
+        }
+    }
+
+    if (s) {
+        if (s - len < sizeof(struct __freelist)) {
+            if (sfp2) {
+                sfp2->nx = sfp1->nx;
+            } else {
+                __flp = sfp1->nx;
+            }
+            return &sfp1->nx;
+        }
+
+        /* Split the chunk, hand out its top part. */
+        cp = (char *)sfp1;
+        s -= len;
+        cp += s;
+        sfp2 = (struct __freelist *)cp;
+        sfp2->sz = len;
+        sfp1->sz = s - sizeof(size_t);
+        return &sfp2->nx;
+    }
+
+    if (__brkval == 0) {
+        __brkval = __malloc_heap_start;
+    }
+
+    cp = __malloc_heap_end;
+    if (cp == 0) {
+        cp = (char *)&xmem_host_space[XMEM_HOST_STACK_LIMIT] - __malloc_margin;
+    }
+    if (cp <= (char *)__brkval) {
+        return 0;
+    }
+
+    avail = cp - (char *)__brkval;
+    if (avail >= len && avail >= len + sizeof(size_t)) {
+        fp1 = (struct __freelist *)__brkval;
+        __brkval = (char *)__brkval + len + sizeof(size_t);
+        fp1->sz = len;
+        return &fp1->nx;
+    }
+
+    return 0;
+}
+
+/**
+ * @docstring
+ * Put the chunk back on the address ordered __flp list, merging it with its
+ * neighbours and giving the top chunk back to __brkval.
+ */
+void xmem_host_free (void *p) {
+    struct __freelist *fp1, *fp2, *fpnew;
+    char *cp1, *cp2, *cpnew;
+
+    if (p == 0) {
+        return;
+    }
+
+    cpnew = (char *)p - sizeof(size_t);
+    fpnew = (struct __freelist *)cpnew;
+    fpnew->nx = 0;
+
+    if (__flp == 0) {
+        if ((char *)p + fpnew->sz == __brkval) {
+            __brkval = cpnew;
+        } else {
+            __flp = fpnew;
+        }
+        return;
+    }
+
+    for (fp1 = __flp, fp2 = 0; fp1; fp2 = fp1, fp1 = fp1->nx) {
+        if (fp1 < fpnew) {
+            continue;
+        }
+        cp1 = (char *)fp1;
+        fpnew->nx = fp1;
+        if ((char *)&fpnew->nx + fpnew->sz == cp1) {
+            fpnew->sz += fp1->sz + sizeof(size_t);
+            fpnew->nx = fp1->nx;
+        }
+        break;
+    }
+
+    if (fp2 == 0) {
+        __flp = fpnew;
+    } else {
+        fp2->nx = fpnew;
+        cp2 = (char *)&fp2->nx;
+        if (cp2 + fp2->sz == cpnew) {
+            fp2->sz += fpnew->sz + sizeof(size_t);
+            fp2->nx = fpnew->nx;
+        }
+    }
+
+    /* If the last chunk is free, hand it back to __brkval. */
+    for (fp1 = __flp, fp2 = 0; fp1->nx != 0; fp2 = fp1, fp1 = fp1->nx)
+        ;
+    cp2 = (char *)&fp1->nx;
+    if (cp2 + fp1->sz == __brkval) {
+        if (fp2 == 0) {
+            __flp = 0;
+        } else {
+            fp2->nx = 0;
+        }
+        __brkval = fp1;
+    }
+}
@@ -0,0 +1,56 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Host memory model. Simulates the data space, the banked external memory
+ * chip behind the 64KB window and the avr-libc malloc globals so the library
+ * can be built and exercised without a board.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#ifndef XMEM_HOST_H_INCLUDED
+#define XMEM_HOST_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+#include <avr/io.h>
+
+/* Lets code tell the host build from the MCU one. */
+#define XMEM_HOST               1
+
+/* Most banks the model can back with memory. */
+#define XMEM_HOST_MAX_BANKS     16
+
+/* The model keeps the fake .data/.bss below this address and the fake stack
+   above it, so a heap with __malloc_heap_end == 0 grows up to here. */
+#define XMEM_HOST_HEAP_START    0x0800
+#define XMEM_HOST_STACK_LIMIT   0x1800
+
+/* Data space addresses and host pointers. */
+#define XMEM_PTR(addr_)     ((void *)&xmem_host_space[(uint16_t)(addr_)])
+#define XMEM_ADDR(ptr_)     ((uint16_t)((uint8_t *)(ptr_) - xmem_host_space))
+
+/* The library tells us whenever XMCRB changes so the window can be remapped. */
+#define XMEM_HOST_REMAP()   xmem_host_remap()
+
+/* avr-libc malloc globals, normally private to avr-libc. */
+extern char *__malloc_heap_start;
+extern char *__malloc_heap_end;
+extern size_t __malloc_margin;
+
+void xmem_host_reset (void);
+void xmem_host_switch_bank (uint8_t bank);
+void xmem_host_remap (void);
+uint8_t xmem_host_selected_bank (void);
+void xmem_host_set_chip_wait_states (uint8_t ws);
+void xmem_host_set_chip_size (uint32_t size);
+uint8_t *xmem_host_chip (uint8_t bank);
+
+/* avr-libc compatible allocator working on the globals above. */
+void *xmem_host_malloc (size_t len);
+void xmem_host_free (void *p);
+
+#define malloc(len_)    xmem_host_malloc(len_)
+#define free(p_)        xmem_host_free(p_)
+
+#endif /* XMEM_HOST_H_INCLUDED */
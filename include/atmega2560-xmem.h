@@ -13,27 +13,524 @@
 #error "Include conf_xmem.h before atmega2560-xmem.h."
 #endif
 
-#if XMEM_WAIT_STATES < 0 || XMEN_WAIT_STATES > 3
+#if XMEM_WAIT_STATES < 0 || XMEM_WAIT_STATES > 3
 #error "XMEM_WAIT_STATES should be a number between 0 and 3."
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* Split the external memory in two sectors with their own wait states, the
+   SRL value of XMCRA. 0 is one sector with XMEM_WAIT_STATES, 1 to 7 put the
+   boundary at (XMEM_SECTOR_LIMIT + 1) * 8KB. */
+#ifndef XMEM_SECTOR_LIMIT
+#define XMEM_SECTOR_LIMIT    0
+#endif
+
+#if XMEM_SECTOR_LIMIT < 0 || XMEM_SECTOR_LIMIT > 7
+#error "XMEM_SECTOR_LIMIT should be a number between 0 and 7."
+#endif
+
+/* Wait states of the lower sector, XMEM_WAIT_STATES is the upper one. */
+#ifndef XMEM_LOWER_WAIT_STATES
+#define XMEM_LOWER_WAIT_STATES  XMEM_WAIT_STATES
+#endif
+
+#if XMEM_LOWER_WAIT_STATES < 0 || XMEM_LOWER_WAIT_STATES > 3
+#error "XMEM_LOWER_WAIT_STATES should be a number between 0 and 3."
+#endif
+
+/* Sectors the bank heaps may use. */
+#define XMEM_SECTOR_BOTH     0
+#define XMEM_SECTOR_LOWER    1
+#define XMEM_SECTOR_UPPER    2
+
+#ifndef XMEM_HEAP_SECTOR
+#define XMEM_HEAP_SECTOR     XMEM_SECTOR_BOTH
+#endif
+
+/* First address of the upper sector. */
+#define XMEM_SECTOR_BOUNDARY    ((XMEM_SECTOR_LIMIT + 1) * 0x2000UL)
+
+/* Last address of a region every bank shares, for boards whose decoder always
+   maps 0x2200 up to it to bank 0. 0 banks the whole window. */
+#ifndef XMEM_COMMON_END
+#define XMEM_COMMON_END      0
+#endif
+
+#if XMEM_COMMON_END && (XMEM_COMMON_END < 0x2200 || XMEM_COMMON_END >= 0xffff || (XMEM_COMMON_END + 1) % 0x200)
+#error "XMEM_COMMON_END should be right below a multiple of 512 between 0x2200 and 0xffff."
+#endif
+
+/* First address that changes with the bank. */
+#define XMEM_BANKED_START    (XMEM_COMMON_END ? XMEM_COMMON_END + 1 : 0x2200)
+
+/* Bank number xmem_malloc, xmem_free and xmem_heap_info take for the common region. */
+#define XMEM_COMMON          0xfe
+
+/* Have xmem_init pick the fastest wait states that work with xmem_calibrate. */
+#ifndef XMEM_CALIBRATE
+#define XMEM_CALIBRATE       0
+#endif
+
+/* Have xmem_init zero every bank with xmem_fill. */
+#ifndef XMEM_CLEAR_ON_INIT
+#define XMEM_CLEAR_ON_INIT   0
+#endif
+
+/* xmem_calibrate could not find working wait states. */
+#define XMEM_CALIBRATE_FAILED   0xff
+
+/* Let xmem_init_ex set the memory size and the bank select callback at run
+   time. XMEM_TOTAL_MEMORY becomes the biggest memory supported. */
+#ifndef XMEM_RUNTIME_CONFIG
+#define XMEM_RUNTIME_CONFIG  0
+#endif
+
+/* Use the library's own allocator for the banks instead of moving the avr-libc heap around. */
+#ifndef XMEM_NATIVE_MALLOC
+#define XMEM_NATIVE_MALLOC   0
+#endif
+
+/* Only move the avr-libc heap to the new bank on the next xmem_malloc/xmem_free/xmem_sync_heap. */
+#ifndef XMEM_LAZY_HEAP
+#define XMEM_LAZY_HEAP       0
+#endif
+
+/* Set up a bank's heap state the first time it's used instead of in xmem_init. */
+#ifndef XMEM_LAZY_BANK_INIT
+#define XMEM_LAZY_BANK_INIT  0
+#endif
+
+/* Bytes xmem_memtest_step tests with interrupts off at a time. */
+#ifndef XMEM_MEMTEST_CHUNK
+#define XMEM_MEMTEST_CHUNK   16
+#endif
+
+/* How many object pools can exist at the same time. */
+#ifndef XMEM_POOLS
+#define XMEM_POOLS           4
+#endif
+
+/* Internal memory used to stage copies between banks, in bytes. */
+#ifndef XMEM_COPY_BUFFER
+#define XMEM_COPY_BUFFER     256
+#endif
+
+/* Far memory lines cached in internal memory by xmem_cache_*, 0 leaves the cache out. */
+#ifndef XMEM_CACHE_LINES
+#define XMEM_CACHE_LINES     0
+#endif
+
+/* Bytes per cache line, a power of two up to 512. */
+#ifndef XMEM_CACHE_LINE_SIZE
+#define XMEM_CACHE_LINE_SIZE 16
+#endif
+
+/* 1 for a direct mapped cache, 2 for a two way set associative one. */
+#ifndef XMEM_CACHE_WAYS
+#define XMEM_CACHE_WAYS      1
+#endif
+
+/* Resident page frames of the xmem_vm_ptr paging layer, 0 leaves it out. */
+#ifndef XMEM_VM_FRAMES
+#define XMEM_VM_FRAMES       0
+#endif
+
+/* Bytes per page, a power of two from 16 up to 512. */
+#ifndef XMEM_VM_PAGE_SIZE
+#define XMEM_VM_PAGE_SIZE    256
+#endif
+
+/* Where the page frames live: XMEM_VM_INTERNAL, a bank or XMEM_COMMON. */
+#define XMEM_VM_INTERNAL     0xff
+
+#ifndef XMEM_VM_FRAME_BANK
+#define XMEM_VM_FRAME_BANK   XMEM_VM_INTERNAL
+#endif
+
+/* Count bank switches, heap flips and heap usage for xmem_get_stats. */
+#ifndef XMEM_STATS
+#define XMEM_STATS           0
+#endif
+
+/* Relocatable blocks handed out by xmem_halloc, 0 leaves the handles out. */
+#ifndef XMEM_HANDLES
+#define XMEM_HANDLES         0
+#endif
+
+/* Hand out the lower 8KB of every bank with xmem_low_alloc. */
+#ifndef XMEM_LOW_HEAP
+#define XMEM_LOW_HEAP        0
+#endif
+
+/* Turn a data space address into a pointer and back. The host model maps
+   the data space somewhere else, on the MCU they are the same thing. */
+#ifndef XMEM_PTR
+#define XMEM_PTR(addr_)     ((void *)(addr_))
+#define XMEM_ADDR(ptr_)     ((uint16_t)(ptr_))
+#endif
+
+/* Fixed size object pool carved out of a bank, see xmem_pool_create. */
+struct xmem_pool {
+    uint8_t bank;           /* Bank the slab lives in. */
+    uint16_t obj_size;      /* Size of every object, 0 if the pool is not in use. */
+    uint16_t free_list;     /* Address of the first freed object, 0 if none. */
+    uint16_t fresh;         /* Address of the first object never handed out. */
+    uint16_t fresh_left;    /* Objects never handed out. */
+    void *slab;             /* What xmem_malloc returned for the objects. */
+};
+
+/* Single producer single consumer byte ring in external memory, see
+   xmem_ring_init. Lives in internal memory, only the bytes are in the bank. */
+struct xmem_ring {
+    uint16_t data;              /* Address of the ring bytes in their bank, or their low block. */
+    uint16_t mask;              /* Size - 1, the size is a power of two. */
+    volatile uint16_t head;     /* Bytes pushed so far, wrapping. Only the producer writes it. */
+    volatile uint16_t tail;     /* Bytes popped so far, wrapping. Only the consumer writes it. */
+    uint8_t bank;               /* Bank of the ring bytes, XMEM_COMMON for the common region. */
+    uint8_t low;                /* The bytes are a xmem_low_alloc block. */
+};
+
+/* Two buffers in two banks, one filled while the other is drained, see
+   xmem_pingpong_init. */
+struct xmem_pingpong {
+    uint16_t data[2];           /* Address of each buffer in its bank. */
+    uint8_t bank[2];            /* Bank of each buffer. */
+    uint16_t size;              /* Bytes in each buffer. */
+    uint16_t fill;              /* Bytes written to the producer's buffer. */
+    uint16_t ready;             /* Bytes in the consumer's buffer. */
+    volatile uint8_t side;      /* The producer's buffer, the consumer has the other one. */
+    volatile uint8_t full;      /* The consumer's buffer holds ready bytes and is not released yet. */
+};
+
+/* Sequential reader or writer over a range of the far space, see xmem_stream_open. */
+struct xmem_stream {
+    uint32_t left;          /* Bytes left in the range. */
+    uint16_t addr;          /* Address of the next byte. */
+    uint16_t run;           /* Bytes from addr to the end of its bank. */
+    uint8_t bank;           /* Bank of the next byte. */
+};
+
+/* Cache counters, see xmem_cache_stats. */
+struct xmem_cache_stats {
+    uint32_t hits;          /* Accesses served from a cached line. */
+    uint32_t misses;        /* Accesses that had to load a line. */
+    uint32_t writebacks;    /* Dirty lines written back to their bank. */
+};
+
+/* Paging counters, see xmem_vm_stats. */
+struct xmem_vm_stats {
+    uint32_t hits;          /* xmem_vm_ptr calls for a resident page. */
+    uint32_t faults;        /* Pages brought into a frame. */
+    uint32_t writebacks;    /* Dirty pages written back to their bank. */
+};
+
+/* Counters kept with XMEM_STATS, see xmem_get_stats. */
+struct xmem_stats {
+    uint32_t switches;              /* Bank changes made by xmem_switch_bank. */
+    uint32_t redundant_switches;    /* xmem_switch_bank calls for the bank already selected. */
+    uint32_t heap_flips;            /* Heap moves by xmem_set_system_heap and xmem_set_xmem_heap. */
+};
+
+/* Heap usage of one bank, see xmem_get_bank_stats. */
+struct xmem_bank_stats {
+    uint16_t high_water;            /* Address right above the highest allocation so far, 0 if none seen. */
+    uint16_t free_blocks;           /* Blocks in the bank's free list. */
+    uint16_t free_bytes;            /* Bytes in those blocks. */
+};
+
+/* Free block size classes in xmem_heap_info: under 16, 32, 64 ... 1024 bytes and the rest. */
+#define XMEM_HEAP_BUCKETS    8
+
+/* Free space of one bank, see xmem_heap_info. */
+struct xmem_heap_info {
+    uint16_t free_blocks;                       /* Blocks in the free list. */
+    uint16_t free_bytes;                        /* Bytes that can be handed out of them. */
+    uint16_t largest;                           /* Biggest of them. */
+    uint16_t unused;                            /* Bytes above the avr-libc __brkval, 0 with the native allocator. */
+    uint8_t fragmentation;                      /* Percent of the free space outside the biggest free area. */
+    uint16_t histogram[XMEM_HEAP_BUCKETS];      /* Free blocks by size class. */
+};
+
+/* Board description for xmem_init_ex. */
+struct xmem_config {
+    uint32_t total_memory;                  /* Bytes of external memory, 0 to find out with xmem_probe. */
+    void (*select_bank)(uint8_t bank);      /* Drives the bank select pins, NULL for XMEM_USER_SWITCH_BANK. */
+    uint8_t wait_states;                    /* Upper sector wait states, like XMEM_WAIT_STATES. */
+    uint8_t lower_wait_states;              /* Lower sector wait states, like XMEM_LOWER_WAIT_STATES. */
+};
+
+/* Relocatable block, see xmem_halloc. 0 is no block. */
+typedef uint8_t xmem_handle_t;
+
+/* Far pointer: bank in bits 16-23, data space address in bits 0-15. Every
+   bank covers XMEM_BANKED_START up to its end address, far pointer arithmetic
+   skips from the end of a bank to XMEM_BANKED_START on the next one. */
+#ifdef __AVR__
+typedef __uint24 xmem_far_t;
+#else
+typedef uint32_t xmem_far_t;
+#endif
+
+#define XMEM_FAR(bank_, ptr_)   (((xmem_far_t)(bank_) << 16) | XMEM_ADDR(ptr_))
+#define XMEM_FAR_BANK(far_)     ((uint8_t)((far_) >> 16))
+#define XMEM_FAR_ADDR(far_)     ((uint16_t)(far_))
+#define XMEM_FAR_START          XMEM_FAR(0, XMEM_PTR(XMEM_BANKED_START))
+
+/* Next state of the 16 bit Galois LFSR behind xmem_fill_pattern and
+   xmem_calibrate, period 65535. Its low byte is the next pattern byte. */
+#define XMEM_LFSR(lfsr_)        ((uint16_t)(((lfsr_) >> 1) ^ (-((lfsr_) & 1) & 0xB400)))
+
+/* Progress of the background memory test, see xmem_memtest_step. */
+struct xmem_memtest {
+    uint32_t tested;            /* Bytes checked so far in the current sweep. */
+    uint32_t size;              /* Bytes in a sweep, the common region, the far space and the lower 8KB. */
+    uint16_t sweeps;            /* Sweeps finished since xmem_memtest_reset. */
+    uint16_t failures;          /* Chunks that failed. */
+    xmem_far_t first_failure;   /* First bad byte found, XMEM_COMMON bank in the common region, below 0x2000 in the lower 8KB. */
+};
 
 void xmem_switch_bank (uint8_t bank);
 void xmem_init (void);
+void xmem_init_ex (const struct xmem_config *config);
+uint32_t xmem_probe (void);
+uint8_t xmem_bank_count (void);
 void *xmem_unshadow_lower_memory (void);
 void xmem_shadow_lower_memory (void);
 void xmem_set_xmem_heap (void);
 void xmem_set_system_heap (void);
+void xmem_sync_heap (void);
+uint8_t xmem_calibrate (void);
 void *xmem_get_current_bank_address_start (void);
 void *xmem_get_current_bank_address_end (void);
+void *xmem_malloc (uint8_t bank, size_t size);
+void xmem_free (uint8_t bank, void *ptr);
+struct xmem_pool *xmem_pool_create (uint8_t bank, uint16_t obj_size, uint16_t count);
+void xmem_pool_destroy (struct xmem_pool *pool);
+void *xmem_pool_alloc (struct xmem_pool *pool);
+void xmem_pool_free (struct xmem_pool *pool, void *obj);
+uint8_t xmem_ring_init (struct xmem_ring *ring, uint8_t bank, uint16_t size);
+uint8_t xmem_ring_init_low (struct xmem_ring *ring, uint8_t bank, uint16_t size);
+void xmem_ring_release (struct xmem_ring *ring);
+uint8_t xmem_ring_push (struct xmem_ring *ring, const void *src, uint16_t len);
+uint16_t xmem_ring_pop (struct xmem_ring *ring, void *dst, uint16_t max);
+uint16_t xmem_ring_count (const struct xmem_ring *ring);
+uint16_t xmem_ring_space (const struct xmem_ring *ring);
+uint8_t xmem_pingpong_init (struct xmem_pingpong *pp, uint8_t bank_a, uint8_t bank_b, uint16_t size);
+void xmem_pingpong_free (struct xmem_pingpong *pp);
+uint16_t xmem_pingpong_write (struct xmem_pingpong *pp, const void *src, uint16_t len);
+uint8_t xmem_pingpong_swap (struct xmem_pingpong *pp);
+void *xmem_pingpong_acquire (struct xmem_pingpong *pp, uint16_t *len);
+void xmem_pingpong_release (struct xmem_pingpong *pp);
+xmem_far_t xmem_far_add (xmem_far_t far, int32_t n);
+int32_t xmem_far_diff (xmem_far_t a, xmem_far_t b);
+uint32_t xmem_far_size (void);
+uint16_t xmem_far_read16 (xmem_far_t far);
+uint32_t xmem_far_read32 (xmem_far_t far);
+void xmem_far_write16 (xmem_far_t far, uint16_t value);
+void xmem_far_write32 (xmem_far_t far, uint32_t value);
+void *xmem_memcpy_far (uint8_t dst_bank, void *dst, uint8_t src_bank, const void *src, size_t len);
+void xmem_fill (uint8_t bank, void *start, void *end, uint8_t value);
+void xmem_fill_pattern (uint8_t bank, void *start, void *end, uint16_t seed);
+void *xmem_verify_pattern (uint8_t bank, void *start, void *end, uint16_t seed);
+void xmem_memtest_reset (void);
+uint8_t xmem_memtest_step (void);
+void xmem_memtest_status (struct xmem_memtest *status);
+void xmem_stream_open (struct xmem_stream *stream, xmem_far_t far, uint32_t len);
+uint16_t xmem_stream_read (struct xmem_stream *stream, void *buf, uint16_t n);
+uint16_t xmem_stream_write (struct xmem_stream *stream, const void *buf, uint16_t n);
+void xmem_heap_info (uint8_t bank, struct xmem_heap_info *info);
+xmem_handle_t xmem_halloc (uint8_t bank, uint16_t size);
+void xmem_hfree (xmem_handle_t handle);
+void *xmem_hlock (xmem_handle_t handle);
+void xmem_hunlock (xmem_handle_t handle);
+uint16_t xmem_hcompact (uint8_t bank);
+uint16_t xmem_low_alloc (uint8_t bank, uint16_t size);
+void xmem_low_free (uint8_t bank, uint16_t block);
+void xmem_low_write (uint8_t bank, uint16_t block, uint16_t offset, const void *src, uint16_t len);
+void xmem_low_read (uint8_t bank, uint16_t block, uint16_t offset, void *dst, uint16_t len);
+void xmem_get_stats (struct xmem_stats *stats);
+void xmem_get_bank_stats (uint8_t bank, struct xmem_bank_stats *stats);
+uint8_t xmem_cache_read8 (xmem_far_t far);
+uint16_t xmem_cache_read16 (xmem_far_t far);
+uint32_t xmem_cache_read32 (xmem_far_t far);
+void xmem_cache_write8 (xmem_far_t far, uint8_t value);
+void xmem_cache_write16 (xmem_far_t far, uint16_t value);
+void xmem_cache_write32 (xmem_far_t far, uint32_t value);
+void xmem_cache_flush (void);
+void xmem_cache_invalidate (void);
+void xmem_cache_stats (struct xmem_cache_stats *stats);
+void *xmem_vm_ptr (uint32_t vaddr, uint8_t write);
+void xmem_vm_flush (void);
+void xmem_vm_invalidate (void);
+void xmem_vm_stats (struct xmem_vm_stats *stats);
 
-/* How many memory banks are there? */
-#if XMEM_TOTAL_MEMORY < 65536
+/* How many memory banks are there? A partial last bank is a bank too. */
+#if XMEM_TOTAL_MEMORY > 254UL * 65536
+#error "Banks are 0 to 253, 0xfe and 0xff mean XMEM_COMMON, XMEM_VM_INTERNAL or no bank. XMEM_TOTAL_MEMORY can't go past 254 * 64KB."
+#elif XMEM_TOTAL_MEMORY <= 65536
 #define XMEM_BANKS           1
 #else
-#define XMEM_BANKS           ((uint8_t)((XMEM_TOTAL_MEMORY / 65536.0)+0.5))
+#define XMEM_BANKS           ((uint8_t)((XMEM_TOTAL_MEMORY + 65535UL) / 65536UL))
 #define XMEM_USE_BANKING
 #endif
 
+/* Bank select lines needed for XMEM_BANKS banks. */
+#define XMEM_BANK_BITS                                                  \
+    (XMEM_BANKS > 128 ? 8 : XMEM_BANKS > 64 ? 7 : XMEM_BANKS > 32 ? 6 : \
+     XMEM_BANKS > 16 ? 5 : XMEM_BANKS > 8 ? 4 : XMEM_BANKS > 4 ? 3 :    \
+     XMEM_BANKS > 2 ? 2 : XMEM_BANKS > 1 ? 1 : 0)
+
+/* Pins of a port that carry bits_ bank select lines starting at pin shift_. */
+#define XMEM_BANK_MASK(shift_, bits_)   ((uint8_t)(((1U << (bits_)) - 1) << (shift_)))
+
+/* Put the bank number on bits_ consecutive pins of a port starting at
+   shift_, with a single write that leaves the other pins as they are. For a
+   512KB board with the bank select lines on PL0-PL2:
+
+       #define XMEM_USER_INIT()  DDRL |= XMEM_BANK_MASK(0, 3);
+       #define XMEM_USER_SWITCH_BANK(bank_)  XMEM_PORT_SELECT_BANK(PORTL, 0, 3, bank_);
+
+   The port is read and then written, if an interrupt handler changes other
+   pins of the same port keep interrupts off around the bank switches. */
+#define XMEM_PORT_SELECT_BANK(port_, shift_, bits_, bank_)              \
+    ((port_) = ((port_) & (uint8_t)~XMEM_BANK_MASK(shift_, bits_))      \
+        | ((uint8_t)((bank_) << (shift_)) & XMEM_BANK_MASK(shift_, bits_)))
+
+extern uint8_t _current_bank;
+
+/* Drive the bank select pins, through the xmem_init_ex callback if there is one. */
+#if XMEM_RUNTIME_CONFIG
+extern void (*_xmem_select_bank)(uint8_t bank);
+
+#define XMEM_SELECT_BANK(bank_)                                         \
+    do {                                                                \
+        if (_xmem_select_bank) {                                        \
+            _xmem_select_bank(bank_);                                   \
+        } else {                                                        \
+            XMEM_USER_SWITCH_BANK(bank_);                               \
+        }                                                               \
+    } while (0)
+#else
+#define XMEM_SELECT_BANK(bank_)                                         \
+    do {                                                                \
+        XMEM_USER_SWITCH_BANK(bank_);                                   \
+    } while (0)
+#endif
+
+/**
+ * @docstring
+ * Select the far pointer's bank if it's not the current one and return a
+ * regular pointer to its byte.
+ */
+static inline void *xmem_far_ptr (xmem_far_t far) {
+    if (_current_bank != XMEM_FAR_BANK(far)) {
+        xmem_switch_bank(XMEM_FAR_BANK(far));
+    }
+
+    return XMEM_PTR(XMEM_FAR_ADDR(far));
+}
+
+static inline uint8_t xmem_far_read8 (xmem_far_t far) {
+    return *(volatile uint8_t *)xmem_far_ptr(far);
+}
+
+static inline void xmem_far_write8 (xmem_far_t far, uint8_t value) {
+    *(volatile uint8_t *)xmem_far_ptr(far) = value;
+}
+
+/**
+ * @docstring
+ * xmem_switch_bank for tight loops, inlined and without the bank range
+ * check. With XMEM_LAZY_HEAP or XMEM_NATIVE_MALLOC it is a compare, a store
+ * and XMEM_SELECT_BANK.
+ */
+static inline void xmem_switch_bank_inline (uint8_t bank) {
+    if (_current_bank == bank) {
+        return;
+    }
+
+    _current_bank = bank;
+    XMEM_SELECT_BANK(bank);
+
+    if (!XMEM_LAZY_HEAP && !XMEM_NATIVE_MALLOC) {
+        xmem_sync_heap();
+    }
+}
+
+/**
+ * @docstring
+ * Remember the current bank, for xmem_bank_pop. Meant for interrupt
+ * handlers that use xmem, see XMEM_ISR.
+ */
+static inline uint8_t xmem_bank_push (void) {
+    return _current_bank;
+}
+
+/**
+ * @docstring
+ * Select a bank between xmem_bank_push and xmem_bank_pop. Only the select
+ * pins change, the heap state is left for the interrupted code, so don't
+ * allocate memory in between. The pins are always driven, the interrupted
+ * code may have set _current_bank and not the pins yet.
+ */
+static inline void xmem_bank_select (uint8_t bank) {
+    _current_bank = bank;
+    XMEM_SELECT_BANK(bank);
+}
+
+/**
+ * @docstring
+ * Go back to the bank saved by xmem_bank_push.
+ */
+static inline void xmem_bank_pop (uint8_t bank) {
+    uint8_t sreg = SREG;
+
+    cli();
+    _current_bank = bank;
+    XMEM_SELECT_BANK(bank);
+    SREG = sreg;
+}
+
+/* Declare an interrupt handler that can switch banks with xmem_bank_select
+   and leaves the interrupted code in the bank it was in:
+
+       XMEM_ISR(TIMER1_COMPA_vect) {
+           xmem_bank_select(1);
+           ...
+       }
+*/
+#define XMEM_ISR(vector_, ...)                                          \
+    static inline void vector_##_xmem (void) __attribute__((always_inline)); \
+    ISR(vector_, ##__VA_ARGS__) {                                       \
+        uint8_t _xmem_bank = xmem_bank_push();                          \
+        vector_##_xmem();                                               \
+        xmem_bank_pop(_xmem_bank);                                      \
+    }                                                                   \
+    static inline void vector_##_xmem (void)
+
+/* Compile time checks, Arduino sketches are C++. */
+#ifdef __cplusplus
+#define XMEM_STATIC_ASSERT(cond_, msg_)     static_assert(cond_, msg_)
+#else
+#define XMEM_STATIC_ASSERT(cond_, msg_)     _Static_assert(cond_, msg_)
+#endif
+
+/* Switch to a bank known at compile time. The bank is checked by the compiler
+   and there is no compare, with XMEM_LAZY_HEAP or XMEM_NATIVE_MALLOC this is
+   a store plus XMEM_SELECT_BANK with a constant bank, which avr-gcc folds to
+   a sbi or cbi for a single select pin like the Megaram one. */
+#define XMEM_SWITCH_BANK_CONST(bank_)                                   \
+    do {                                                                \
+        XMEM_STATIC_ASSERT((bank_) < XMEM_BANKS, "No such bank.");      \
+        _current_bank = (bank_);                                        \
+        XMEM_SELECT_BANK((bank_));                                      \
+        if (!XMEM_LAZY_HEAP && !XMEM_NATIVE_MALLOC) {                   \
+            xmem_sync_heap();                                           \
+        }                                                               \
+    } while (0)
+
 #endif /* CONF_XMEM_H_INCLUDED */
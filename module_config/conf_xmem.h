@@ -21,20 +21,31 @@
     PORTL = 0xFF;
 
 /* This is the bank switch needed for the Megaram (128KB) shield for Arduino Mega 2560.
-   PD7 is bank selector so we only have to set one bit to 0 or 1. */
+   PD7 is bank selector so we only have to set one bit to 0 or 1, the rest of PORTD
+   is left alone. */
 #define XMEM_EXAMPLE_MEGARAM_USER_SWITCH_BANK(bank_) \
-    PORTD = 0x7F | ((bank_ & 1) << 7);
+    XMEM_PORT_SELECT_BANK(PORTD, 7, 1, bank_);
+
+/* A 512KB board with the bank select lines on PL0-PL2 and the chip enable on PL7.
+   XMEM_PORT_SELECT_BANK only changes the bank pins, with a single port write. */
+#define XMEM_EXAMPLE_512KB_USER_INIT() \
+    DDRL |= _BV(7) | XMEM_BANK_MASK(0, 3); \
+    PORTL |= _BV(7);
+
+#define XMEM_EXAMPLE_512KB_USER_SWITCH_BANK(bank_) \
+    XMEM_PORT_SELECT_BANK(PORTL, 0, 3, bank_);
 
 /* Does your board have special initialization?
    This only applies if you have mroe than 64KB of external memory and want
-   to initialize the pins that will be used for banking. Check XMEM_EXAMPLE_MEGARAM_USER_INIT. */
+   to initialize the pins that will be used for banking. Check XMEM_EXAMPLE_MEGARAM_USER_INIT
+   and XMEM_EXAMPLE_512KB_USER_INIT. */
 #define XMEM_USER_INIT() ((void) 0)
 
 /* More than 64KB ? Then you need banks and you need to provide the library
    with this macro so it can switch banks and manage them for you, this usually
    requires setting the higher address bits with the pins you wired in your
    board, if you are using 64KB or less, just leave it void..
-   Check XMEM_EXAMPLE_MEGARAM_USER_SWITCH_BANK.*/
+   Check XMEM_EXAMPLE_MEGARAM_USER_SWITCH_BANK and XMEM_EXAMPLE_512KB_USER_SWITCH_BANK.*/
 #define XMEM_USER_SWITCH_BANK(bank_) ((void) 0)
 
 /* Does your memory require you to wait? Let me know about it!
@@ -44,4 +55,81 @@
    3 = Wait two cycles during read/write and wait one cycle before driving out new address */
 #define XMEM_WAIT_STATES  0
 
+/* Two sectors with their own wait states? This is the SRL value of XMCRA,
+   0 = one sector using XMEM_WAIT_STATES.
+   1 to 6 = lower sector up to 0x3FFF, 0x5FFF ... 0xDFFF, upper sector above.
+   7 = everything is the lower sector.
+   XMEM_WAIT_STATES applies to the upper sector, XMEM_LOWER_WAIT_STATES to the lower one. */
+#define XMEM_SECTOR_LIMIT  0
+#define XMEM_LOWER_WAIT_STATES  XMEM_WAIT_STATES
+
+/* Last address of the region every bank shares (0x2200 up to it), for boards whose
+   decoder always maps it to bank 0. 0 banks the whole window. */
+#define XMEM_COMMON_END  0
+
+/* Describe the board at run time with xmem_init_ex(), XMEM_TOTAL_MEMORY is then
+   the biggest memory supported. */
+#define XMEM_RUNTIME_CONFIG  0
+
+/* Measure the wait states the memory needs in xmem_init() and use them instead. */
+#define XMEM_CALIBRATE  0
+
+/* Zero every bank in xmem_init(). */
+#define XMEM_CLEAR_ON_INIT  0
+
+/* Set up a bank's heap state the first time it's used instead of in xmem_init(). */
+#define XMEM_LAZY_BANK_INIT  0
+
+/* Bytes xmem_memtest_step() tests with interrupts off at a time, keep it small
+   so interrupt handlers are only held back for a few hundred cycles. */
+#define XMEM_MEMTEST_CHUNK  16
+
+/* Sector the bank heaps use: XMEM_SECTOR_BOTH, XMEM_SECTOR_LOWER or XMEM_SECTOR_UPPER.
+   Keep the heap in the sector with no wait states. */
+#define XMEM_HEAP_SECTOR  XMEM_SECTOR_BOTH
+
+/* Leave malloc() on the internal memory and manage the banks with the library's
+   own allocator (xmem_malloc/xmem_free). Switching banks will not have to move
+   the avr-libc heap around. */
+#define XMEM_NATIVE_MALLOC  0
+
+/* Only drive the bank select pins on a bank switch and leave the avr-libc heap
+   where it is until the next xmem_malloc/xmem_free/xmem_sync_heap call. Call
+   xmem_sync_heap before using malloc()/free() directly if you set this. */
+#define XMEM_LAZY_HEAP  0
+
+/* How many object pools (xmem_pool_create) can exist at the same time. */
+#define XMEM_POOLS  4
+
+/* Internal memory buffer (bytes) used to copy data between banks. */
+#define XMEM_COPY_BUFFER  256
+
+/* Cache far memory lines in internal memory for the xmem_cache_* accessors.
+   XMEM_CACHE_LINES lines of XMEM_CACHE_LINE_SIZE bytes (power of two up to 512),
+   XMEM_CACHE_WAYS is 1 for direct mapped or 2 for two way set associative.
+   0 lines leaves the cache out. */
+#define XMEM_CACHE_LINES      0
+#define XMEM_CACHE_LINE_SIZE  16
+#define XMEM_CACHE_WAYS       1
+
+/* Count bank switches, heap flips and per bank heap usage, read them with
+   xmem_get_stats and xmem_get_bank_stats. Costs a few instructions per
+   switch when on, nothing when off. */
+#define XMEM_STATS  0
+
+/* How many relocatable blocks (xmem_halloc) can exist at the same time,
+   0 leaves them out. */
+#define XMEM_HANDLES  0
+
+/* Hand out the lower 8KB of every bank, which the heap can't reach, with
+   xmem_low_alloc. Takes 32 bytes of internal memory per bank. */
+#define XMEM_LOW_HEAP  0
+
+/* Page the far space through XMEM_VM_FRAMES frames of XMEM_VM_PAGE_SIZE bytes
+   (power of two from 16 up to 512) with xmem_vm_ptr, 0 frames leaves it out.
+   The frames live in XMEM_VM_FRAME_BANK: XMEM_VM_INTERNAL, a bank or XMEM_COMMON. */
+#define XMEM_VM_FRAMES      0
+#define XMEM_VM_PAGE_SIZE   256
+#define XMEM_VM_FRAME_BANK  XMEM_VM_INTERNAL
+
 #endif /* CONF_XMEM_H_INCLUDED */
@@ -5,47 +5,43 @@
  ******************************************************************************/
 
 #include <stdlib.h>
+#include <string.h>
 #include <avr/io.h>
 
 #include "conf_xmem.h"
 #include "atmega2560-xmem.h"
+#include "xmem-private.h"
 
-/* If memory is not a multiple of 64KB we need to find out what's the last bank size. */
-#if (XMEM_TOTAL_MEMORY % 65536) == 0
-#define XMEM_LAST_BANK_END  ((void *)0xffff)
+struct bank_heap_state _system_heap_state;
+#if XMEM_RUNTIME_CONFIG
+struct bank_heap_state *_bank_state;    /* Set up by xmem_init_ex for the banks found. */
 #else
-#define XMEM_LAST_BANK_END  ((void *)((XMEM_TOTAL_MEMORY % 65536) - 1))
-#endif
-
-/* Atmega XMEM address space block */
-#define XMEM_START      ((void *)0x2200)
-#define XMEM_END        ((void *)0xffff)
-
-/* The address space to use for unshadowed memory */
-#define XMEM_SHADOWED_START ((void *)0x8000)
-#define XMEM_SHADOWED_END   ((void *)0x9fff)
-
-struct bank_heap_state {
-    void *__brkval;             /* Pointer between __malloc_heap_start and __malloc_heap_end, shows growth. */
-    void *__flp;                /* Pointer to the free block list that malloc handles. */
-    char *__malloc_heap_start;  /* Pointer to the beginning of the heap. */
-    char *__malloc_heap_end;    /* Pointer to the end of the heap, 0 if the heap is below the stack. */
-};
-
-/* Private heap variables */
-#ifdef __cplusplus
-extern "C" {
+struct bank_heap_state _bank_state[XMEM_BANKS];
 #endif
-    extern void *__flp;
-    extern void *__brkval;
-#ifdef __cplusplus
-}
+#if XMEM_COMMON_END
+struct bank_heap_state _common_state;
 #endif
-
-struct bank_heap_state _system_heap_state;
-struct bank_heap_state _bank_state[XMEM_BANKS];
 uint8_t _system_heap_in_place = 0;
+static uint8_t _xmem_ready = 0;    /* xmem_init ran, the globals may hold a bank heap. */
 uint8_t _current_bank = -1;
+uint8_t _heap_bank = -1;
+uint8_t _xmem_xmm = XMEM_XMM;
+#if XMEM_RUNTIME_CONFIG
+uint8_t _xmem_banks = XMEM_BANKS;
+uint16_t _xmem_last_bank_end = XMEM_ADDR(XMEM_END);
+void (*_xmem_select_bank)(uint8_t bank) = NULL;
+#endif
+#if XMEM_LAZY_BANK_INIT
+uint8_t _bank_ready[(XMEM_BANKS + 7) / 8];
+#endif
+#if XMEM_STATS
+struct xmem_stats _stats;
+#if XMEM_RUNTIME_CONFIG
+uint16_t *_bank_high_water;
+#else
+uint16_t _bank_high_water[XMEM_BANKS];
+#endif
+#endif
 
 /**
  * @docstring
@@ -69,6 +65,87 @@ static void _xmem_load_bank_state (struct bank_heap_state *bs) {
     __malloc_heap_end = bs->__malloc_heap_end;
 }
 
+/**
+ * @docstring
+ * Give a bank an empty heap from XMEM_HEAP_START to XMEM_HEAP_END, the last
+ * bank ends at XMEM_LAST_BANK_END if that comes first. A last bank that
+ * ends below XMEM_HEAP_START, say below the upper sector, gets a heap with
+ * no room that starts right after its end.
+ */
+void _xmem_init_bank_state (uint8_t bank) {
+    struct bank_heap_state *bs = &_bank_state[bank];
+
+    bs->__flp = NULL;
+    bs->__malloc_heap_start = (char *)XMEM_HEAP_START;
+    bs->__malloc_heap_end = (char *)XMEM_HEAP_END;
+
+    if (bank == XMEM_BANK_COUNT - 1 && XMEM_ADDR(XMEM_LAST_BANK_END) < XMEM_ADDR(XMEM_HEAP_END)) {
+        bs->__malloc_heap_end = (char *)XMEM_LAST_BANK_END;
+        if (XMEM_ADDR(XMEM_LAST_BANK_END) < XMEM_ADDR(XMEM_HEAP_START)) {
+            bs->__malloc_heap_start = (char *)XMEM_LAST_BANK_END + 1;
+        }
+    }
+
+    bs->__brkval = bs->__malloc_heap_start;
+
+#if XMEM_NATIVE_MALLOC
+    /* The free blocks are laid out on first use. */
+    bs->heap_ready = 0;
+#endif
+
+#if XMEM_LAZY_BANK_INIT
+    _bank_ready[bank >> 3] |= _BV(bank & 7);
+#endif
+}
+
+/**
+ * @docstring
+ * Save the heap state of the bank the avr-libc globals hold, there is none
+ * before xmem_init picks bank 0 or while the system heap is in place.
+ */
+static inline void _xmem_save_heap_bank (void) {
+    if (_xmem_heap_exists(_heap_bank)) {
+        _xmem_save_bank_state(_xmem_heap_state(_heap_bank));
+        _xmem_stat_high_water(_heap_bank, XMEM_ADDR(__brkval));
+    }
+}
+
+/**
+ * @docstring
+ * Make the avr-libc globals hold the heap of a bank, or of the common region
+ * with XMEM_COMMON. The bank is not selected.
+ */
+void _xmem_switch_heap (uint8_t bank) {
+    if (_heap_bank == bank) {
+        return;
+    }
+
+    _xmem_save_heap_bank();
+    _xmem_load_bank_state(_xmem_heap_state(bank));
+    _heap_bank = bank;
+}
+
+/**
+ * @docstring
+ * Make the avr-libc globals hold the current bank's heap if the heap is in xmem.
+ */
+static inline void _xmem_sync_heap (void) {
+    if (_system_heap_in_place || _heap_bank == _current_bank) {
+        return;
+    }
+
+    _xmem_switch_heap(_current_bank);
+}
+
+/**
+ * @docstring
+ * With XMEM_LAZY_HEAP bank switches leave the heap of the previous bank in
+ * place, call this before using malloc()/free() directly.
+ */
+void xmem_sync_heap (void) {
+    _xmem_sync_heap();
+}
+
 /**
  * @docstring
  * Unshadow the lower 8KB of the extended memory and return a pointer that
@@ -76,17 +153,21 @@ static void _xmem_load_bank_state (struct bank_heap_state *bs) {
  * The pointer returned is the start of your 8KB block of memory.
  */
 void *xmem_unshadow_lower_memory (void) {
-    /* Configures PORTC pins as output pins. */
-    DDRC = 0xff;
+    uint8_t xmm = _xmem_xmm > XMEM_XMM_LOW ? _xmem_xmm : XMEM_XMM_LOW;
+    uint8_t pins = XMEM_XMM_PINS(xmm) & ~XMEM_XMM_PINS(_xmem_xmm);
 
-    /* Port C has all 0s now. */
-    PORTC = 0x00;
+    /* The pins we are about to release output 0, pins the memory never
+       used are left alone. */
+    PORTC &= ~pins;
+    DDRC |= pins;
 
-    /* Release the 5,6,7 pins from extended memory addressing duty. They are still
+    /* Release the 5,6,7 pins (if the memory size didn't already) from extended
+       memory addressing duty. They are still
        addressing memory, they are just always set to 0 and that will leave us with
        only 13 pins (8KB) of address in external memory. Since these pins are zeroed out,
        you will be effectively addressing the lower 8KB of external memory. */
-    XMCRB = (1 << XMM0) | (1 << XMM1);
+    XMCRB = (XMCRB & ~XMEM_XMM_MASK) | (xmm << XMM0);
+    XMEM_HOST_REMAP();
 
     return XMEM_SHADOWED_START;
 }
@@ -96,14 +177,10 @@ void *xmem_unshadow_lower_memory (void) {
  * Shadow the lower 8KB of the extended memory and set normal addressing pins.
  */
 void xmem_shadow_lower_memory (void) {
-    /* Configures PORTC pins as output pins. */
-    DDRC = 0xff;
-
-    /* Port C has all 0s now. */
-    PORTC = 0x00;
-
-    /* Set every pin to regular memory addressing duty. */
-    XMCRB = 0;
+    /* Give the pins back to memory addressing duty, the memory interface
+       overrides their port settings. */
+    XMCRB = (XMCRB & ~XMEM_XMM_MASK) | (_xmem_xmm << XMM0);
+    XMEM_HOST_REMAP();
 }
 
 /**
@@ -111,22 +188,24 @@ void xmem_shadow_lower_memory (void) {
  * Switch bank if the bank exist and is not the current one.
  */
 void xmem_switch_bank (uint8_t bank) {
-    if (_current_bank == bank || bank > XMEM_BANKS) {
+    if (_current_bank == bank) {
+        XMEM_STAT_INC(redundant_switches);
         return;
     }
 
-    if (!_system_heap_in_place) {
-        /* Save the current bank heap state */
-        _xmem_save_bank_state(&_bank_state[_current_bank]);
-
-        /* And restore the state we are switching to. */
-        _xmem_load_bank_state(&_bank_state[bank]);
+    if (bank >= XMEM_BANK_COUNT) {
+        return;
     }
 
+    XMEM_STAT_INC(switches);
     _current_bank = bank;
 
     /* Have the user set the higher bits */
-    XMEM_USER_SWITCH_BANK(bank);
+    XMEM_SELECT_BANK(bank);
+
+#if !XMEM_LAZY_HEAP
+    _xmem_sync_heap();
+#endif
 }
 
 /**
@@ -140,10 +219,12 @@ void xmem_set_system_heap (void) {
         return;
     }
 
-    _xmem_save_bank_state(&_bank_state[_current_bank]);
+    _xmem_save_heap_bank();
     _xmem_load_bank_state(&_system_heap_state);
 
+    _heap_bank = -1;
     _system_heap_in_place = 1;
+    XMEM_STAT_INC(heap_flips);
 }
 
 /**
@@ -153,14 +234,16 @@ void xmem_set_system_heap (void) {
  * memory using the current bank.
  */
 void xmem_set_xmem_heap (void) {
-    if (!_system_heap_in_place) {
+    /* With the native allocator malloc() never leaves the internal memory. */
+    if (XMEM_NATIVE_MALLOC || !_system_heap_in_place) {
         return;
     }
 
     _xmem_save_bank_state(&_system_heap_state);
-    _xmem_load_bank_state(&_bank_state[_current_bank]);
 
     _system_heap_in_place = 0;
+    _xmem_sync_heap();
+    XMEM_STAT_INC(heap_flips);
 }
 
 /**
@@ -168,7 +251,7 @@ void xmem_set_xmem_heap (void) {
  * Returns the last valid address in the current selected bank.
  */
 void *xmem_get_current_bank_address_start (void) {
-    return (void *)_bank_state[_current_bank].__malloc_heap_start;
+    return (void *)_xmem_heap_state(_current_bank)->__malloc_heap_start;
 }
 
 /**
@@ -176,46 +259,224 @@ void *xmem_get_current_bank_address_start (void) {
  * Returns the last valid address in the current selected bank.
  */
 void *xmem_get_current_bank_address_end (void) {
-    return (void *)_bank_state[_current_bank].__malloc_heap_end;
+    return (void *)_xmem_heap_state(_current_bank)->__malloc_heap_end;
 }
 
 /**
  * @docstring
- * Initializes the external memory and the internal data structures if we are managing the heap in the xmem.
+ * Set up the external memory interface and the per bank heap states for
+ * XMEM_BANK_COUNT banks, _xmem_xmm address pins and the given wait states.
  */
-void xmem_init (void) {
-   /* TODO: Calculate the # of pins we need for the given memory and
-      calculate a mask for XMCRB. Save this mask because we will need it
-      to restore XMCRB later on if we want to access the first 8KB of XMEM.
-      This assumes we want all 8 bits from PORTC. */
-    XMCRB = 0;
+static void _xmem_init (uint8_t wait_states, uint8_t lower_wait_states) {
+    /* Only take the PORTC pins the memory needs for addressing, the rest
+       stay regular IO. The lower memory calls restore this mask. */
+    XMCRB = (XMCRB & ~XMEM_XMM_MASK) | (_xmem_xmm << XMM0);
+    XMEM_HOST_REMAP();
 
-    /* XMEM Enable bit, entire xmem is treated like one sector and set the wait
-       states for it. */
-    XMCRA = (1 << SRE) | (XMEM_WAIT_STATES << SRW10);
+    /* XMEM Enable bit, the sector limit and the wait states of both sectors.
+       With a limit of 0 the entire xmem is the upper sector. */
+    XMCRA = (1 << SRE) | (XMEM_SECTOR_LIMIT << SRL0)
+        | ((lower_wait_states & 3) << SRW00) | ((wait_states & 3) << SRW10);
 
     /* Have the user configure his extra pins. */
     XMEM_USER_INIT();
 
+    /* Again? The avr-libc globals may hold a bank heap, put the system one back first. */
+    if (_xmem_ready) {
+        xmem_set_system_heap();
+    }
     _xmem_save_bank_state(&_system_heap_state);
+    _xmem_ready = 1;
 
-    /* If heap should be in xmem ram then we should let avr-libc where is it. */
+#if XMEM_LAZY_BANK_INIT
+    /* Every bank gets its heap state the first time it's used. */
+    memset(_bank_ready, 0, sizeof(_bank_ready));
+#else
+    for (uint8_t i = 0; i < XMEM_BANK_COUNT; i++) {
+        _xmem_init_bank_state(i);
+    }
+#endif
+
+#if XMEM_COMMON_END
+    /* The common region lives in bank 0 and has a heap of its own. */
     __malloc_heap_start = (char *)XMEM_START;
-    __malloc_heap_end = (char *)XMEM_END;
+    __malloc_heap_end = (char *)XMEM_COMMON_HEAP_END;
     __brkval = (char *)XMEM_START;
+    _xmem_save_bank_state(&_common_state);
+#endif
 
-#ifdef XMEM_USE_BANKING
-    /* All banks except the last one have 64KB size. */
-    for (uint8_t i = 0; i < XMEM_BANKS - 1; i++) {
-        _xmem_save_bank_state(&_bank_state[i]);
-    }
-#endif /* XMEM_USE_BANKKING */
-
-    /* Save the last bank with the correct address space size. */
-    __malloc_heap_end = (char *)XMEM_LAST_BANK_END;
-    _xmem_save_bank_state(&_bank_state[XMEM_BANKS - 1]);
+#if XMEM_NATIVE_MALLOC
+    /* The banks belong to xmem_malloc(), give malloc() its internal heap back
+       and have the free blocks laid out on first use. */
+    _xmem_load_bank_state(&_system_heap_state);
+    _system_heap_in_place = 1;
 
+#if XMEM_COMMON_END
+    _common_state.heap_ready = 0;
+#endif
+#else
     _system_heap_in_place = 0;
+#endif
+
+    /* Neither the pins nor the avr-libc globals point at any bank yet. */
+    _current_bank = -1;
+    _heap_bank = -1;
 
     xmem_switch_bank(0);
+    _xmem_sync_heap();
+
+#if XMEM_CALIBRATE
+    xmem_calibrate();
+#endif
+
+#if XMEM_CLEAR_ON_INIT
+    /* Bank 0 last so it stays selected. */
+    for (uint8_t i = XMEM_BANK_COUNT; i--; ) {
+        xmem_fill(i, XMEM_START, i == XMEM_BANK_COUNT - 1 ? XMEM_LAST_BANK_END : XMEM_END, 0);
+    }
+#endif
+
+#if XMEM_STATS
+    memset(&_stats, 0, sizeof(_stats));
+    memset(_bank_high_water, 0, XMEM_BANK_COUNT * sizeof(_bank_high_water[0]));
+#endif
+}
+
+/**
+ * @docstring
+ * Initializes the external memory and the internal data structures if we are managing the heap in the xmem.
+ */
+void xmem_init (void) {
+#if XMEM_RUNTIME_CONFIG
+    struct xmem_config config = {
+        XMEM_TOTAL_MEMORY, NULL, XMEM_WAIT_STATES, XMEM_LOWER_WAIT_STATES
+    };
+
+    xmem_init_ex(&config);
+#else
+    _xmem_xmm = XMEM_XMM;
+    _xmem_init(XMEM_WAIT_STATES, XMEM_LOWER_WAIT_STATES);
+#endif
+}
+
+/**
+ * @docstring
+ * Return how many banks xmem_init set up.
+ */
+uint8_t xmem_bank_count (void) {
+    return XMEM_BANK_COUNT;
+}
+
+#if XMEM_RUNTIME_CONFIG
+
+/**
+ * @docstring
+ * XMM value that keeps the address pins a memory of this size needs.
+ */
+static uint8_t _xmem_xmm_for (uint32_t size) {
+    uint8_t xmm = 0;
+
+    /* XMM 1 to 6 each take one pin off, 7 takes the last two. */
+    while (xmm < 7 && size <= (xmm == 6 ? 256 : 32768UL >> xmm)) {
+        xmm++;
+    }
+
+    return xmm;
 }
+
+/**
+ * @docstring
+ * Make room in the internal heap for the state of up to banks banks. The
+ * room is only taken again when a bigger memory shows up, so a binary built
+ * for 512KB running on a 64KB board keeps a single bank's state. Returns how
+ * many banks there is room for, fewer than asked if the heap runs out.
+ */
+static uint8_t _xmem_bank_state_room (uint8_t banks) {
+    static uint8_t room = 0;
+    uint16_t size = sizeof(struct bank_heap_state);
+    uint8_t *state;
+
+#if XMEM_STATS
+    size += sizeof(uint16_t);
+#endif
+#if XMEM_LOW_HEAP
+    size += sizeof(struct low_heap);
+#endif
+
+    if (banks <= room) {
+        return banks;
+    }
+
+    /* The state that was there goes, malloc() has to be on the internal heap. */
+    if (room) {
+        xmem_set_system_heap();
+        free(_bank_state);
+        room = 0;
+    }
+
+    while ((state = malloc((size_t)banks * size)) == NULL && banks > 1) {
+        banks--;
+    }
+
+    if (state == NULL) {
+        return 0;
+    }
+
+    memset(state, 0, (size_t)banks * size);
+
+    _bank_state = (struct bank_heap_state *)state;
+    state += banks * sizeof(struct bank_heap_state);
+#if XMEM_STATS
+    _bank_high_water = (uint16_t *)state;
+    state += banks * sizeof(uint16_t);
+#endif
+#if XMEM_LOW_HEAP
+    _low_heap = (struct low_heap *)state;
+#endif
+
+    room = banks;
+    return banks;
+}
+
+/**
+ * @docstring
+ * xmem_init for a board described at run time. A config->total_memory of 0
+ * is found out with xmem_probe, anything above XMEM_TOTAL_MEMORY is cut down
+ * to it. The per bank state comes from the internal heap, sized for the
+ * banks found. If it can't hold a single bank's state the external memory
+ * is left off.
+ */
+void xmem_init_ex (const struct xmem_config *config) {
+    uint32_t size = config->total_memory;
+    uint8_t banks;
+
+    _xmem_select_bank = config->select_bank;
+
+    if (size == 0) {
+        /* The probe needs the interface on with every address pin. */
+        XMCRA = (1 << SRE) | (3 << SRW10);
+        XMEM_USER_INIT();
+        _current_bank = -1;
+        size = xmem_probe();
+    }
+
+    if (size == 0 || size > XMEM_TOTAL_MEMORY) {
+        size = XMEM_TOTAL_MEMORY;
+    }
+
+    banks = size < 65536 ? 1 : (uint8_t)((size + 65535) / 65536);
+    _xmem_banks = _xmem_bank_state_room(banks);
+    if (_xmem_banks == 0) {
+        return;
+    }
+    if (_xmem_banks < banks) {
+        size = (uint32_t)_xmem_banks * 65536;
+    }
+
+    _xmem_last_bank_end = (size % 65536) ? (uint16_t)(size % 65536) - 1 : 0xffff;
+    _xmem_xmm = _xmem_xmm_for(size);
+
+    _xmem_init(config->wait_states, config->lower_wait_states);
+}
+
+#endif /* XMEM_RUNTIME_CONFIG */
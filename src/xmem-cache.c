@@ -0,0 +1,227 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Cache of far memory lines in internal memory.
+ *
+ * XMEM_CACHE_LINES lines of XMEM_CACHE_LINE_SIZE bytes, direct mapped or two
+ * way set associative (XMEM_CACHE_WAYS). Lines never cross a bank:
+ * XMEM_BANKED_START and the end of a bank are multiples of any line size up
+ * to 512. Writes only touch the cached line, which goes back to its bank
+ * when it's evicted or on xmem_cache_flush. Far pointers into internal
+ * memory or the common region skip the cache.
+ *
+ * The cache does not see accesses made any other way, flush it before
+ * touching cached memory directly and invalidate it after.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#if XMEM_CACHE_LINES
+
+#if XMEM_CACHE_WAYS != 1 && XMEM_CACHE_WAYS != 2
+#error "XMEM_CACHE_WAYS should be 1 or 2."
+#endif
+
+#if XMEM_CACHE_LINE_SIZE & (XMEM_CACHE_LINE_SIZE - 1) || XMEM_CACHE_LINE_SIZE > 512
+#error "XMEM_CACHE_LINE_SIZE should be a power of two up to 512."
+#endif
+
+#define XMEM_CACHE_SETS     (XMEM_CACHE_LINES / XMEM_CACHE_WAYS)
+
+#if XMEM_CACHE_SETS & (XMEM_CACHE_SETS - 1) || XMEM_CACHE_SETS * XMEM_CACHE_WAYS != XMEM_CACHE_LINES
+#error "XMEM_CACHE_LINES / XMEM_CACHE_WAYS should be a power of two."
+#endif
+
+#define XMEM_CACHE_OFFSET   (XMEM_CACHE_LINE_SIZE - 1)
+
+struct cache_line {
+    xmem_far_t tag;     /* Far pointer to the first byte, 0 if the line is empty. */
+    uint8_t dirty;      /* Written since it was loaded. */
+    uint8_t data[XMEM_CACHE_LINE_SIZE];
+};
+
+static struct cache_line _cache[XMEM_CACHE_SETS][XMEM_CACHE_WAYS];
+#if XMEM_CACHE_WAYS == 2
+static uint8_t _cache_victim[XMEM_CACHE_SETS];  /* Way to evict next, the least recently used. */
+#endif
+static struct xmem_cache_stats _cache_stats;
+
+/**
+ * @docstring
+ * Write a dirty line back to its bank.
+ */
+static void _xmem_cache_writeback (struct cache_line *line) {
+    xmem_switch_bank(XMEM_FAR_BANK(line->tag));
+    memcpy(XMEM_PTR(XMEM_FAR_ADDR(line->tag)), line->data, XMEM_CACHE_LINE_SIZE);
+    line->dirty = 0;
+    _cache_stats.writebacks++;
+}
+
+/**
+ * @docstring
+ * Line holding the byte at far, loading it if it's not cached. The bank
+ * is folded into the set index so the same address on every bank does not
+ * fight for one set.
+ */
+static struct cache_line *_xmem_cache_line (xmem_far_t far) {
+    xmem_far_t tag = far & ~(xmem_far_t)XMEM_CACHE_OFFSET;
+    uint16_t set = ((XMEM_FAR_ADDR(far) / XMEM_CACHE_LINE_SIZE) ^ XMEM_FAR_BANK(far)) & (XMEM_CACHE_SETS - 1);
+    struct cache_line *line = &_cache[set][0];
+
+#if XMEM_CACHE_WAYS == 2
+    if (line->tag == tag) {
+        _cache_victim[set] = 1;
+        _cache_stats.hits++;
+        return line;
+    }
+
+    if (line[1].tag == tag) {
+        _cache_victim[set] = 0;
+        _cache_stats.hits++;
+        return &line[1];
+    }
+
+    line += _cache_victim[set];
+    _cache_victim[set] ^= 1;
+#else
+    if (line->tag == tag) {
+        _cache_stats.hits++;
+        return line;
+    }
+#endif
+
+    _cache_stats.misses++;
+
+    if (line->dirty) {
+        _xmem_cache_writeback(line);
+    }
+
+    xmem_switch_bank(XMEM_FAR_BANK(tag));
+    memcpy(line->data, XMEM_PTR(XMEM_FAR_ADDR(tag)), XMEM_CACHE_LINE_SIZE);
+    line->tag = tag;
+
+    return line;
+}
+
+/**
+ * @docstring
+ * Copy len bytes between buf and the far memory at far, line by line.
+ * Values are little endian in memory and on both the MCU and the host, so
+ * the integer accessors go through here too.
+ */
+static void _xmem_cache_access (xmem_far_t far, uint8_t *buf, uint8_t len, uint8_t write) {
+    while (len) {
+        uint16_t offset = XMEM_FAR_ADDR(far) & XMEM_CACHE_OFFSET;
+        uint8_t n = len;
+        uint8_t *data;
+
+        if (XMEM_FAR_ADDR(far) < XMEM_ADDR(XMEM_BANK_START)) {
+            data = XMEM_PTR(XMEM_FAR_ADDR(far));
+            n = 1;
+        } else {
+            struct cache_line *line = _xmem_cache_line(far);
+
+            data = &line->data[offset];
+            if (n > XMEM_CACHE_LINE_SIZE - offset) {
+                n = XMEM_CACHE_LINE_SIZE - offset;
+            }
+            line->dirty |= write;
+        }
+
+        if (write) {
+            memcpy(data, buf, n);
+        } else {
+            memcpy(buf, data, n);
+        }
+
+        buf += n;
+        len -= n;
+        far = xmem_far_add(far, n);
+    }
+}
+
+uint8_t xmem_cache_read8 (xmem_far_t far) {
+    if (XMEM_FAR_ADDR(far) < XMEM_ADDR(XMEM_BANK_START)) {
+        return *(volatile uint8_t *)XMEM_PTR(XMEM_FAR_ADDR(far));
+    }
+
+    return _xmem_cache_line(far)->data[XMEM_FAR_ADDR(far) & XMEM_CACHE_OFFSET];
+}
+
+uint16_t xmem_cache_read16 (xmem_far_t far) {
+    uint16_t value;
+
+    _xmem_cache_access(far, (uint8_t *)&value, sizeof(value), 0);
+
+    return value;
+}
+
+uint32_t xmem_cache_read32 (xmem_far_t far) {
+    uint32_t value;
+
+    _xmem_cache_access(far, (uint8_t *)&value, sizeof(value), 0);
+
+    return value;
+}
+
+void xmem_cache_write8 (xmem_far_t far, uint8_t value) {
+    struct cache_line *line;
+
+    if (XMEM_FAR_ADDR(far) < XMEM_ADDR(XMEM_BANK_START)) {
+        *(volatile uint8_t *)XMEM_PTR(XMEM_FAR_ADDR(far)) = value;
+        return;
+    }
+
+    line = _xmem_cache_line(far);
+    line->data[XMEM_FAR_ADDR(far) & XMEM_CACHE_OFFSET] = value;
+    line->dirty = 1;
+}
+
+void xmem_cache_write16 (xmem_far_t far, uint16_t value) {
+    _xmem_cache_access(far, (uint8_t *)&value, sizeof(value), 1);
+}
+
+void xmem_cache_write32 (xmem_far_t far, uint32_t value) {
+    _xmem_cache_access(far, (uint8_t *)&value, sizeof(value), 1);
+}
+
+/**
+ * @docstring
+ * Write every dirty line back to its bank. Lines stay cached.
+ */
+void xmem_cache_flush (void) {
+    for (uint16_t set = 0; set < XMEM_CACHE_SETS; set++) {
+        for (uint8_t way = 0; way < XMEM_CACHE_WAYS; way++) {
+            if (_cache[set][way].dirty) {
+                _xmem_cache_writeback(&_cache[set][way]);
+            }
+        }
+    }
+}
+
+/**
+ * @docstring
+ * Forget every cached line, dirty ones included. Call xmem_cache_flush
+ * first to keep the writes.
+ */
+void xmem_cache_invalidate (void) {
+    memset(_cache, 0, sizeof(_cache));
+}
+
+/**
+ * @docstring
+ * Copy the counters out and start counting again.
+ */
+void xmem_cache_stats (struct xmem_cache_stats *stats) {
+    *stats = _cache_stats;
+    memset(&_cache_stats, 0, sizeof(_cache_stats));
+}
+
+#endif /* XMEM_CACHE_LINES */
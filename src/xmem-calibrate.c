@@ -0,0 +1,101 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Wait state calibration.
+ *
+ * Every sector is tried with 0 to 3 wait states and keeps the first setting
+ * where a pseudo random fill and its complement read back intact. The test
+ * covers XMEM_COPY_BUFFER bytes at the start of the sector in the current
+ * bank, whose contents are kept in the copy buffer and put back afterwards.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#define XMEM_CALIBRATE_SEED     0xACE1
+
+/**
+ * @docstring
+ * Fill the block with a 16 bit Galois LFSR sequence, xor'ed with invert,
+ * and check it reads back.
+ */
+static uint8_t _xmem_pattern_test (volatile uint8_t *block, uint8_t invert) {
+    uint16_t lfsr = XMEM_CALIBRATE_SEED;
+
+    for (uint16_t i = 0; i < XMEM_COPY_BUFFER; i++) {
+        lfsr = XMEM_LFSR(lfsr);
+        block[i] = (uint8_t)lfsr ^ invert;
+    }
+
+    /* Have the host model write the pattern through to its chip. */
+    XMEM_HOST_REMAP();
+
+    lfsr = XMEM_CALIBRATE_SEED;
+    for (uint16_t i = 0; i < XMEM_COPY_BUFFER; i++) {
+        lfsr = XMEM_LFSR(lfsr);
+        if (block[i] != ((uint8_t)lfsr ^ invert)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @docstring
+ * Find the fewest wait states a sector works with. shift is the position of
+ * the sector's SRW bits in XMCRA. Returns 4 if none works, leaving the
+ * slowest setting in place.
+ */
+static uint8_t _xmem_calibrate_sector (volatile uint8_t *block, uint8_t shift) {
+    uint8_t ws;
+
+    for (uint16_t i = 0; i < XMEM_COPY_BUFFER; i++) {
+        _copy_buffer[i] = block[i];
+    }
+
+    for (ws = 0; ws < 4; ws++) {
+        XMCRA = (XMCRA & ~(3 << shift)) | (ws << shift);
+
+        if (_xmem_pattern_test(block, 0x00) && _xmem_pattern_test(block, 0xff)) {
+            break;
+        }
+    }
+
+    for (uint16_t i = 0; i < XMEM_COPY_BUFFER; i++) {
+        block[i] = _copy_buffer[i];
+    }
+    XMEM_HOST_REMAP();
+
+    return ws;
+}
+
+/**
+ * @docstring
+ * Set both sectors to the fewest wait states that pass a pattern test and
+ * return them as the SRW bits of XMCRA, or XMEM_CALIBRATE_FAILED if a
+ * sector fails even with 3.
+ */
+uint8_t xmem_calibrate (void) {
+    uint8_t lower = 0, upper = 0;
+
+#if XMEM_SECTOR_LIMIT != 0
+    lower = _xmem_calibrate_sector(XMEM_START, SRW00);
+#endif
+#if XMEM_SECTOR_LIMIT == 0
+    upper = _xmem_calibrate_sector(XMEM_START, SRW10);
+#elif XMEM_SECTOR_LIMIT != 7
+    upper = _xmem_calibrate_sector(XMEM_PTR(XMEM_SECTOR_BOUNDARY), SRW10);
+#endif
+
+    if (lower > 3 || upper > 3) {
+        return XMEM_CALIBRATE_FAILED;
+    }
+
+    return XMCRA & (_BV(SRW11) | _BV(SRW10) | _BV(SRW01) | _BV(SRW00));
+}
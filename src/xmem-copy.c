@@ -0,0 +1,70 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Copies between banks.
+ *
+ * Every bank shows up in the same window so a byte can't be read from one
+ * bank and written to another without switching in between. Data is staged
+ * through a buffer in internal memory instead, which costs two switches per
+ * XMEM_COPY_BUFFER bytes.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+uint8_t _copy_buffer[XMEM_COPY_BUFFER];
+
+/**
+ * @docstring
+ * True if the pointer is in internal memory or the common region, which
+ * every bank sees.
+ */
+static inline uint8_t _xmem_is_internal (const void *ptr) {
+    return XMEM_ADDR(ptr) < XMEM_ADDR(XMEM_BANK_START);
+}
+
+/**
+ * @docstring
+ * Copy len bytes from src in src_bank to dst in dst_bank. Pointers into the
+ * internal memory or the common region can be given with any bank. Ranges
+ * must not run past the end of their bank. The destination bank is left
+ * selected. Returns dst.
+ */
+void *xmem_memcpy_far (uint8_t dst_bank, void *dst, uint8_t src_bank, const void *src, size_t len) {
+    uint8_t *d = dst;
+    const uint8_t *s = src;
+
+    if (_xmem_is_internal(src)) {
+        src_bank = dst_bank;
+    } else if (_xmem_is_internal(dst)) {
+        dst_bank = src_bank;
+    }
+
+    if (src_bank == dst_bank) {
+        xmem_switch_bank(dst_bank);
+        memmove(dst, src, len);
+        return dst;
+    }
+
+    while (len) {
+        uint16_t chunk = len < XMEM_COPY_BUFFER ? len : XMEM_COPY_BUFFER;
+
+        xmem_switch_bank(src_bank);
+        _xmem_copy(_copy_buffer, s, chunk);
+
+        xmem_switch_bank(dst_bank);
+        _xmem_copy(d, _copy_buffer, chunk);
+
+        s += chunk;
+        d += chunk;
+        len -= chunk;
+    }
+
+    return dst;
+}
@@ -0,0 +1,103 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Far pointers: every bank seen as one linear space.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+/**
+ * @docstring
+ * Move a far pointer n bytes, carrying into the next or previous banks.
+ */
+xmem_far_t xmem_far_add (xmem_far_t far, int32_t n) {
+    uint8_t bank = XMEM_FAR_BANK(far);
+    int32_t addr = (int32_t)XMEM_FAR_ADDR(far) + n;
+
+    while (addr > XMEM_ADDR(XMEM_END)) {
+        addr -= (int32_t)XMEM_BANK_SIZE;
+        bank++;
+    }
+
+    while (addr < XMEM_ADDR(XMEM_BANK_START)) {
+        addr += (int32_t)XMEM_BANK_SIZE;
+        bank--;
+    }
+
+    return XMEM_FAR(bank, XMEM_PTR(addr));
+}
+
+/**
+ * @docstring
+ * Bytes from b to a in the linear space.
+ */
+int32_t xmem_far_diff (xmem_far_t a, xmem_far_t b) {
+    return ((int32_t)XMEM_FAR_BANK(a) - XMEM_FAR_BANK(b)) * (int32_t)XMEM_BANK_SIZE
+        + ((int32_t)XMEM_FAR_ADDR(a) - XMEM_FAR_ADDR(b));
+}
+
+/**
+ * @docstring
+ * Size of the linear space, starting at XMEM_FAR_START.
+ */
+uint32_t xmem_far_size (void) {
+    return (uint32_t)(XMEM_BANK_COUNT - 1) * XMEM_BANK_SIZE
+        + (uint16_t)(XMEM_ADDR(XMEM_LAST_BANK_END) - XMEM_ADDR(XMEM_BANK_START)) + 1;
+}
+
+/**
+ * @docstring
+ * True if size bytes from far run past the end of its bank.
+ */
+static inline uint8_t _xmem_far_straddles (xmem_far_t far, uint8_t size) {
+    return XMEM_FAR_ADDR(far) > (uint16_t)(XMEM_ADDR(XMEM_END) - (size - 1));
+}
+
+uint16_t xmem_far_read16 (xmem_far_t far) {
+    if (!_xmem_far_straddles(far, 2)) {
+        return *(volatile uint16_t *)xmem_far_ptr(far);
+    }
+
+    return xmem_far_read8(far) | ((uint16_t)xmem_far_read8(xmem_far_add(far, 1)) << 8);
+}
+
+uint32_t xmem_far_read32 (xmem_far_t far) {
+    uint32_t value = 0;
+
+    if (!_xmem_far_straddles(far, 4)) {
+        return *(volatile uint32_t *)xmem_far_ptr(far);
+    }
+
+    for (uint8_t i = 0; i < 4; i++) {
+        value |= (uint32_t)xmem_far_read8(xmem_far_add(far, i)) << (i * 8);
+    }
+
+    return value;
+}
+
+void xmem_far_write16 (xmem_far_t far, uint16_t value) {
+    if (!_xmem_far_straddles(far, 2)) {
+        *(volatile uint16_t *)xmem_far_ptr(far) = value;
+        return;
+    }
+
+    xmem_far_write8(far, value);
+    xmem_far_write8(xmem_far_add(far, 1), value >> 8);
+}
+
+void xmem_far_write32 (xmem_far_t far, uint32_t value) {
+    if (!_xmem_far_straddles(far, 4)) {
+        *(volatile uint32_t *)xmem_far_ptr(far) = value;
+        return;
+    }
+
+    for (uint8_t i = 0; i < 4; i++) {
+        xmem_far_write8(xmem_far_add(far, i), value >> (i * 8));
+    }
+}
@@ -0,0 +1,152 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Bulk fill and pattern check.
+ *
+ * Clearing a bank or running a memory test a byte at a time spends most of
+ * its time on the loop itself, and random() is slower still. These loops
+ * handle eight bytes per turn, and the test pattern is the bytes of a 16 bit
+ * Galois LFSR, which does not repeat within a bank (period 65535), so a
+ * stuck address line shows up as well as a bad cell.
+ *
+ * Ranges are inclusive like xmem_get_current_bank_address_end and can be in
+ * the unshadowed lower memory window too.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+/**
+ * @docstring
+ * Select the bank and return how many bytes there are from start to end,
+ * 0 if end is below start or there is no such bank. XMEM_COMMON is there
+ * from any bank.
+ */
+static uint16_t _xmem_fill_range (uint8_t bank, void *start, void *end) {
+    if (XMEM_ADDR(end) < XMEM_ADDR(start) || !_xmem_heap_exists(bank)) {
+        return 0;
+    }
+
+    xmem_switch_bank(bank);
+
+    return XMEM_ADDR(end) - XMEM_ADDR(start) + 1;
+}
+
+/**
+ * @docstring
+ * The seed the LFSR starts from, it would stay at 0 forever.
+ */
+static inline uint16_t _xmem_fill_seed (uint16_t seed) {
+    return seed ? seed : 1;
+}
+
+/**
+ * @docstring
+ * Set every byte from start to end of a bank to value. The bank is left
+ * selected.
+ */
+void xmem_fill (uint8_t bank, void *start, void *end, uint8_t value) {
+    volatile uint8_t *p = start;
+    uint16_t n = _xmem_fill_range(bank, start, end);
+
+    for (uint16_t blocks = n >> 3; blocks; blocks--) {
+        *p++ = value;
+        *p++ = value;
+        *p++ = value;
+        *p++ = value;
+        *p++ = value;
+        *p++ = value;
+        *p++ = value;
+        *p++ = value;
+    }
+
+    for (n &= 7; n; n--) {
+        *p++ = value;
+    }
+}
+
+/**
+ * @docstring
+ * Fill from start to end of a bank with the LFSR pattern started at seed.
+ * Give every bank its own seed so a bank that aliases another one fails
+ * xmem_verify_pattern. The bank is left selected.
+ */
+void xmem_fill_pattern (uint8_t bank, void *start, void *end, uint16_t seed) {
+    volatile uint8_t *p = start;
+    uint16_t n = _xmem_fill_range(bank, start, end);
+    uint16_t lfsr = _xmem_fill_seed(seed);
+
+    for (uint16_t blocks = n >> 3; blocks; blocks--) {
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+        lfsr = XMEM_LFSR(lfsr); *p++ = lfsr;
+    }
+
+    for (n &= 7; n; n--) {
+        lfsr = XMEM_LFSR(lfsr);
+        *p++ = lfsr;
+    }
+}
+
+/**
+ * @docstring
+ * Check the range holds what xmem_fill_pattern wrote with the same seed.
+ * Returns a pointer to the first byte that doesn't, NULL if they all do.
+ * A bank that doesn't exist fails at start. Eight bytes are compared at a
+ * time and only a block that failed is gone over again, if it reads back
+ * right the second time the fault is intermittent and the block's first
+ * byte is returned. The bank is left selected.
+ */
+void *xmem_verify_pattern (uint8_t bank, void *start, void *end, uint16_t seed) {
+    volatile uint8_t *p = start;
+    volatile uint8_t *block = NULL;
+    uint16_t n = _xmem_fill_range(bank, start, end);
+    uint16_t lfsr = _xmem_fill_seed(seed);
+    uint8_t tail = n & 7;
+
+    if (!_xmem_heap_exists(bank)) {
+        return start;
+    }
+
+    for (uint16_t blocks = n >> 3; blocks; blocks--) {
+        uint16_t block_lfsr = lfsr;
+        uint8_t bad = 0;
+
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+        lfsr = XMEM_LFSR(lfsr); bad |= *p++ ^ (uint8_t)lfsr;
+
+        if (bad) {
+            lfsr = block_lfsr;
+            p -= 8;
+            block = p;
+            tail = 8;
+            break;
+        }
+    }
+
+    for (; tail; tail--) {
+        lfsr = XMEM_LFSR(lfsr);
+        if (*p != (uint8_t)lfsr) {
+            return (void *)p;
+        }
+        p++;
+    }
+
+    return (void *)block;
+}
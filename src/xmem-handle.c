@@ -0,0 +1,162 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Relocatable blocks.
+ *
+ * A handle is an index into a table in internal memory that holds where its
+ * block is. Blocks come from xmem_malloc and can only be used between
+ * xmem_hlock and xmem_hunlock, so xmem_hcompact is free to move the
+ * unlocked ones. Compacting slides every unlocked block down into the free
+ * space right below it, lowest block first, so the free space between them
+ * gathers above the highest one. Locked blocks and blocks that are not
+ * behind a handle don't move, the free space gathers above each of them
+ * instead.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#if XMEM_HANDLES
+
+#if XMEM_HANDLES > 255
+#error "XMEM_HANDLES should be 255 or less."
+#endif
+
+struct handle {
+    uint16_t addr;      /* Address of the block, 0 if the handle is not in use. */
+    uint16_t size;      /* Bytes asked for. */
+    uint8_t bank;       /* Bank the block lives in. */
+    uint8_t locks;      /* xmem_hlock calls not undone yet. */
+};
+
+static struct handle _handles[XMEM_HANDLES];
+
+static inline struct handle *_xmem_handle (xmem_handle_t handle) {
+    if (handle == 0 || handle > XMEM_HANDLES || _handles[handle - 1].addr == 0) {
+        return NULL;
+    }
+
+    return &_handles[handle - 1];
+}
+
+/**
+ * @docstring
+ * Allocate a relocatable block of size bytes in the given bank. Returns 0
+ * if there's no free handle or the bank has no room.
+ */
+xmem_handle_t xmem_halloc (uint8_t bank, uint16_t size) {
+    void *ptr;
+
+    for (uint8_t i = 0; i < XMEM_HANDLES; i++) {
+        if (_handles[i].addr) {
+            continue;
+        }
+
+        ptr = xmem_malloc(bank, size);
+        if (ptr == NULL) {
+            return 0;
+        }
+
+        _handles[i].addr = XMEM_ADDR(ptr);
+        _handles[i].size = size;
+        _handles[i].bank = bank;
+        _handles[i].locks = 0;
+
+        return i + 1;
+    }
+
+    return 0;
+}
+
+/**
+ * @docstring
+ * Give a block back to its bank, locked or not.
+ */
+void xmem_hfree (xmem_handle_t handle) {
+    struct handle *h = _xmem_handle(handle);
+
+    if (h == NULL) {
+        return;
+    }
+
+    xmem_free(h->bank, XMEM_PTR(h->addr));
+    h->addr = 0;
+}
+
+/**
+ * @docstring
+ * Select the block's bank and return where the block is. The block stays
+ * there until as many xmem_hunlock calls. Returns NULL for a bad handle.
+ */
+void *xmem_hlock (xmem_handle_t handle) {
+    struct handle *h = _xmem_handle(handle);
+
+    if (h == NULL) {
+        return NULL;
+    }
+
+    h->locks++;
+    xmem_switch_bank(h->bank);
+
+    return XMEM_PTR(h->addr);
+}
+
+/**
+ * @docstring
+ * Let xmem_hcompact move the block again once every lock is undone.
+ */
+void xmem_hunlock (xmem_handle_t handle) {
+    struct handle *h = _xmem_handle(handle);
+
+    if (h != NULL && h->locks) {
+        h->locks--;
+    }
+}
+
+/**
+ * @docstring
+ * Slide the unlocked blocks of a bank down over the free space between
+ * them, lowest block first. Returns how many blocks moved. The bank is left
+ * selected.
+ */
+uint16_t xmem_hcompact (uint8_t bank) {
+    uint16_t above = 0;
+    uint16_t moved = 0;
+
+    while (1) {
+        struct handle *h = NULL;
+        void *ptr;
+
+        /* Blocks only slide into the free space right below them and keep
+           their order, so going up by the old address visits each once. */
+        for (uint8_t i = 0; i < XMEM_HANDLES; i++) {
+            struct handle *c = &_handles[i];
+
+            if (c->addr && c->bank == bank && c->addr > above && (h == NULL || c->addr < h->addr)) {
+                h = c;
+            }
+        }
+
+        if (h == NULL) {
+            return moved;
+        }
+
+        above = h->addr;
+        if (h->locks) {
+            continue;
+        }
+
+        ptr = _xmem_slide_down(bank, XMEM_PTR(h->addr));
+        if (XMEM_ADDR(ptr) != h->addr) {
+            h->addr = XMEM_ADDR(ptr);
+            moved++;
+        }
+    }
+}
+
+#endif /* XMEM_HANDLES */
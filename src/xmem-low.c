@@ -0,0 +1,173 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Blocks in the lower 8KB of every bank.
+ *
+ * The first 8KB of each chip sit behind the internal memory and only show up
+ * at 0x8000 while the lower memory is unshadowed, when the rest of the
+ * external memory can't be reached. Blocks are handed out in
+ * XMEM_LOW_GRANULE byte granules tracked by two bitmaps per bank in internal
+ * memory, and data goes in and out with xmem_low_write and xmem_low_read,
+ * which unshadow around every copy. Blocks are their address in the 0x8000
+ * window.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#if XMEM_LOW_HEAP
+
+#if XMEM_RUNTIME_CONFIG
+struct low_heap *_low_heap;     /* Set up by xmem_init_ex for the banks found. */
+#else
+struct low_heap _low_heap[XMEM_BANKS];
+#endif
+
+static inline uint8_t _xmem_low_bit (const uint8_t *map, uint8_t i) {
+    return map[i >> 3] & (1 << (i & 7));
+}
+
+static inline void _xmem_low_set (uint8_t *map, uint8_t i, uint8_t on) {
+    if (on) {
+        map[i >> 3] |= 1 << (i & 7);
+    } else {
+        map[i >> 3] &= ~(1 << (i & 7));
+    }
+}
+
+/**
+ * @docstring
+ * Reserve size bytes in the lower 8KB of a bank. Returns the block's
+ * address in the unshadowed window, or 0 if there's no room.
+ */
+uint16_t xmem_low_alloc (uint8_t bank, uint16_t size) {
+    struct low_heap *lh;
+    uint8_t need, run = 0;
+
+    if (bank >= XMEM_BANK_COUNT || size == 0 || size > XMEM_LOW_SIZE) {
+        return 0;
+    }
+
+    lh = &_low_heap[bank];
+    need = (size + XMEM_LOW_GRANULE - 1) / XMEM_LOW_GRANULE;
+
+    /* First fit. */
+    for (uint8_t i = 0; i < XMEM_LOW_GRANULES; i++) {
+        if (_xmem_low_bit(lh->used, i)) {
+            run = 0;
+            continue;
+        }
+
+        if (++run == need) {
+            uint8_t first = i + 1 - need;
+
+            for (uint8_t j = first; j <= i; j++) {
+                _xmem_low_set(lh->used, j, 1);
+            }
+            _xmem_low_set(lh->start, first, 1);
+
+            return XMEM_ADDR(XMEM_SHADOWED_START) + first * XMEM_LOW_GRANULE;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @docstring
+ * Give a block from xmem_low_alloc back to its bank.
+ */
+void xmem_low_free (uint8_t bank, uint16_t block) {
+    struct low_heap *lh;
+    uint8_t i;
+
+    if (bank >= XMEM_BANK_COUNT || block < XMEM_ADDR(XMEM_SHADOWED_START)) {
+        return;
+    }
+
+    lh = &_low_heap[bank];
+    i = (block - XMEM_ADDR(XMEM_SHADOWED_START)) / XMEM_LOW_GRANULE;
+
+    if (i >= XMEM_LOW_GRANULES || !_xmem_low_bit(lh->start, i)) {
+        return;
+    }
+
+    _xmem_low_set(lh->start, i, 0);
+    do {
+        _xmem_low_set(lh->used, i, 0);
+        i++;
+    } while (i < XMEM_LOW_GRANULES && _xmem_low_bit(lh->used, i) && !_xmem_low_bit(lh->start, i));
+}
+
+/**
+ * @docstring
+ * Copy len bytes between mem and a low block. mem is in internal memory or
+ * in the current bank, where it's staged through the copy buffer since the
+ * current bank can't be reached while unshadowed. The current bank is
+ * selected again on return.
+ */
+static void _xmem_low_copy (uint8_t bank, uint16_t low, uint8_t *mem, uint16_t len, uint8_t write) {
+    uint8_t mem_bank = _current_bank;
+    uint8_t staged = XMEM_ADDR(mem) >= XMEM_ADDR(XMEM_START);
+
+    while (len) {
+        uint16_t n = len;
+        uint8_t *buf = mem;
+
+        if (staged) {
+            buf = _copy_buffer;
+            if (n > XMEM_COPY_BUFFER) {
+                n = XMEM_COPY_BUFFER;
+            }
+            if (write) {
+                memcpy(buf, mem, n);
+            }
+        }
+
+        xmem_bank_select(bank);
+        xmem_unshadow_lower_memory();
+
+        if (write) {
+            memcpy(XMEM_PTR(low), buf, n);
+        } else {
+            memcpy(buf, XMEM_PTR(low), n);
+        }
+
+        xmem_shadow_lower_memory();
+        xmem_bank_select(mem_bank);
+
+        if (staged && !write) {
+            memcpy(mem, buf, n);
+        }
+
+        mem += n;
+        low += n;
+        len -= n;
+    }
+}
+
+/**
+ * @docstring
+ * Write len bytes from src to a low block, starting offset bytes in. Does
+ * not check the block bounds.
+ */
+void xmem_low_write (uint8_t bank, uint16_t block, uint16_t offset, const void *src, uint16_t len) {
+    _xmem_low_copy(bank, block + offset, (uint8_t *)src, len, 1);
+}
+
+/**
+ * @docstring
+ * Read len bytes from a low block, starting offset bytes in, to dst. Does
+ * not check the block bounds.
+ */
+void xmem_low_read (uint8_t bank, uint16_t block, uint16_t offset, void *dst, uint16_t len) {
+    _xmem_low_copy(bank, block + offset, dst, len, 0);
+}
+
+#endif /* XMEM_LOW_HEAP */
@@ -0,0 +1,530 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Per bank allocator.
+ *
+ * With XMEM_NATIVE_MALLOC every bank is managed by a two level segregated fit
+ * allocator (TLSF) whose bookkeeping lives in _bank_state, so malloc() and
+ * the avr-libc globals stay on the internal memory and switching banks does
+ * not touch them. Allocation and free are O(1): the free list to use is found
+ * with two bitmap lookups and neighbours are merged through boundary tags.
+ *
+ * Blocks are addressed with 16 bit data space addresses and start with a 16
+ * bit header holding the block size (a multiple of 4, header included) and
+ * two flags in the low bits. Free blocks also hold the next and previous
+ * blocks of their free list and repeat their size in the last two bytes.
+ *
+ * Without XMEM_NATIVE_MALLOC the same calls go through avr-libc malloc() with
+ * the bank's heap state.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+/**
+ * @docstring
+ * Count one free block in a heap report.
+ */
+static void _xmem_heap_info_add (struct xmem_heap_info *info, uint16_t size) {
+    uint8_t bucket = 0;
+
+    while (bucket < XMEM_HEAP_BUCKETS - 1 && size >= (16U << bucket)) {
+        bucket++;
+    }
+
+    info->histogram[bucket]++;
+    info->free_blocks++;
+    info->free_bytes += size;
+    if (size > info->largest) {
+        info->largest = size;
+    }
+}
+
+#if XMEM_NATIVE_MALLOC
+
+#define XMEM_BLOCK_FREE         0x0001  /* This block is free. */
+#define XMEM_BLOCK_PREV_FREE    0x0002  /* The block right below this one is free. */
+#define XMEM_BLOCK_FLAGS        0x0003
+#define XMEM_BLOCK_HEADER       2
+#define XMEM_BLOCK_MIN          (1 << XMEM_FL_MIN)
+
+/* Offsets of the free list links and of the footer in a free block. */
+#define XMEM_BLOCK_NEXT         2
+#define XMEM_BLOCK_PREV         4
+#define XMEM_BLOCK_FOOTER       2
+
+static inline uint16_t _xmem_peek (uint16_t addr) {
+    return *(uint16_t *)XMEM_PTR(addr);
+}
+
+static inline void _xmem_poke (uint16_t addr, uint16_t value) {
+    *(uint16_t *)XMEM_PTR(addr) = value;
+}
+
+/**
+ * @docstring
+ * Index of the most significant bit set.
+ */
+static inline uint8_t _xmem_fls (uint16_t x) {
+    return (sizeof(unsigned int) * 8 - 1) - __builtin_clz(x);
+}
+
+/**
+ * @docstring
+ * Size class a free block of the given size belongs to.
+ */
+static void _xmem_mapping (uint16_t size, uint8_t *fl, uint8_t *sl) {
+    uint8_t f = _xmem_fls(size);
+
+    *sl = (size >> (f - XMEM_SL_BITS)) & (XMEM_SL_COUNT - 1);
+    *fl = f - XMEM_FL_MIN;
+}
+
+/**
+ * @docstring
+ * Put a free block at the head of its class list.
+ */
+static void _xmem_insert_block (struct bank_heap_state *bs, uint16_t block, uint16_t size) {
+    uint8_t fl, sl;
+    uint16_t head;
+
+    _xmem_mapping(size, &fl, &sl);
+    head = bs->blocks[fl][sl];
+
+    _xmem_poke(block + XMEM_BLOCK_NEXT, head);
+    _xmem_poke(block + XMEM_BLOCK_PREV, 0);
+    if (head) {
+        _xmem_poke(head + XMEM_BLOCK_PREV, block);
+    }
+
+    bs->blocks[fl][sl] = block;
+    bs->fl_bitmap |= 1 << fl;
+    bs->sl_bitmap[fl] |= 1 << sl;
+}
+
+/**
+ * @docstring
+ * Take a free block out of its class list.
+ */
+static void _xmem_remove_block (struct bank_heap_state *bs, uint16_t block, uint16_t size) {
+    uint8_t fl, sl;
+    uint16_t next = _xmem_peek(block + XMEM_BLOCK_NEXT);
+    uint16_t prev = _xmem_peek(block + XMEM_BLOCK_PREV);
+
+    if (next) {
+        _xmem_poke(next + XMEM_BLOCK_PREV, prev);
+    }
+
+    if (prev) {
+        _xmem_poke(prev + XMEM_BLOCK_NEXT, next);
+        return;
+    }
+
+    _xmem_mapping(size, &fl, &sl);
+    bs->blocks[fl][sl] = next;
+
+    if (!next) {
+        bs->sl_bitmap[fl] &= ~(1 << sl);
+        if (!bs->sl_bitmap[fl]) {
+            bs->fl_bitmap &= ~(1 << fl);
+        }
+    }
+}
+
+/**
+ * @docstring
+ * Lay out the bank as one free block followed by a used, empty sentinel
+ * block that stops merges at the end of the bank. A heap too small for
+ * that is left without free blocks.
+ */
+static void _xmem_heap_init (struct bank_heap_state *bs) {
+    uint16_t start = XMEM_ADDR(bs->__malloc_heap_start);
+    uint32_t room = (uint32_t)XMEM_ADDR(bs->__malloc_heap_end) + 1 - start;
+    uint16_t size = (uint16_t)((room - XMEM_BLOCK_HEADER) & ~XMEM_BLOCK_FLAGS);
+
+    bs->fl_bitmap = 0;
+    memset(bs->sl_bitmap, 0, sizeof(bs->sl_bitmap));
+    memset(bs->blocks, 0, sizeof(bs->blocks));
+    bs->heap_ready = 1;
+
+    if (room < XMEM_BLOCK_HEADER + XMEM_BLOCK_MIN + XMEM_BLOCK_HEADER) {
+        return;
+    }
+
+    _xmem_poke(start, size | XMEM_BLOCK_FREE);
+    _xmem_poke(start + size - XMEM_BLOCK_FOOTER, size);
+    _xmem_poke(start + size, XMEM_BLOCK_PREV_FREE);
+    _xmem_insert_block(bs, start, size);
+}
+
+/**
+ * @docstring
+ * Allocate size bytes in the given bank. The bank is left selected so the
+ * returned pointer can be used right away. Returns NULL if there's no room.
+ */
+void *xmem_malloc (uint8_t bank, size_t size) {
+    struct bank_heap_state *bs;
+    uint16_t need, search, block, bsize;
+    uint8_t fl, sl, sl_map;
+    uint16_t fl_map;
+
+    if (!_xmem_heap_exists(bank) || size == 0 || size >= XMEM_BANK_SIZE) {
+        return NULL;
+    }
+
+    bs = _xmem_heap_state(bank);
+    if (bank != XMEM_COMMON) {
+        xmem_switch_bank(bank);
+    }
+
+    if (!bs->heap_ready) {
+        _xmem_heap_init(bs);
+    }
+
+    need = (size + XMEM_BLOCK_HEADER + XMEM_BLOCK_FLAGS) & ~XMEM_BLOCK_FLAGS;
+    if (need < XMEM_BLOCK_MIN) {
+        need = XMEM_BLOCK_MIN;
+    }
+
+    /* Round up to the next class so any block found there is big enough. */
+    search = need + (1 << (_xmem_fls(need) - XMEM_SL_BITS)) - 1;
+    _xmem_mapping(search, &fl, &sl);
+
+    sl_map = bs->sl_bitmap[fl] & (uint8_t)(0xff << sl);
+    if (!sl_map) {
+        fl_map = bs->fl_bitmap & (uint16_t)(0xffff << (fl + 1));
+        if (!fl_map) {
+            return NULL;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = bs->sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+
+    block = bs->blocks[fl][sl];
+    bsize = _xmem_peek(block) & ~XMEM_BLOCK_FLAGS;
+    _xmem_remove_block(bs, block, bsize);
+
+    if (bsize - need >= XMEM_BLOCK_MIN) {
+        /* Give the rest back, the block above already knows it sits on a free one. */
+        uint16_t rest = block + need;
+        uint16_t rsize = bsize - need;
+
+        _xmem_poke(rest, rsize | XMEM_BLOCK_FREE);
+        _xmem_poke(rest + rsize - XMEM_BLOCK_FOOTER, rsize);
+        _xmem_insert_block(bs, rest, rsize);
+
+        bsize = need;
+    } else {
+        uint16_t next = block + bsize;
+
+        _xmem_poke(next, _xmem_peek(next) & ~XMEM_BLOCK_PREV_FREE);
+    }
+
+    /* Free blocks never sit next to each other, the one below is in use. */
+    _xmem_poke(block, bsize);
+    _xmem_stat_high_water(bank, block + bsize);
+
+    return XMEM_PTR(block + XMEM_BLOCK_HEADER);
+}
+
+/**
+ * @docstring
+ * Free a block returned by xmem_malloc for the same bank, merging it with
+ * its free neighbours. The bank is left selected.
+ */
+void xmem_free (uint8_t bank, void *ptr) {
+    struct bank_heap_state *bs;
+    uint16_t block, header, size, next, nheader;
+
+    if (ptr == NULL || !_xmem_heap_exists(bank)) {
+        return;
+    }
+
+    bs = _xmem_heap_state(bank);
+    if (bank != XMEM_COMMON) {
+        xmem_switch_bank(bank);
+    }
+
+    block = XMEM_ADDR(ptr) - XMEM_BLOCK_HEADER;
+    header = _xmem_peek(block);
+    size = header & ~XMEM_BLOCK_FLAGS;
+
+    next = block + size;
+    nheader = _xmem_peek(next);
+    if (nheader & XMEM_BLOCK_FREE) {
+        _xmem_remove_block(bs, next, nheader & ~XMEM_BLOCK_FLAGS);
+        size += nheader & ~XMEM_BLOCK_FLAGS;
+    }
+
+    if (header & XMEM_BLOCK_PREV_FREE) {
+        uint16_t psize = _xmem_peek(block - XMEM_BLOCK_FOOTER);
+
+        block -= psize;
+        _xmem_remove_block(bs, block, psize);
+        size += psize;
+    }
+
+    _xmem_poke(block, size | XMEM_BLOCK_FREE);
+    _xmem_poke(block + size - XMEM_BLOCK_FOOTER, size);
+
+    next = block + size;
+    _xmem_poke(next, _xmem_peek(next) | XMEM_BLOCK_PREV_FREE);
+
+    _xmem_insert_block(bs, block, size);
+}
+
+/**
+ * @docstring
+ * Move the block at ptr down into the free block right below it, if there
+ * is one, and free the space it leaves. Returns where the block is now. The
+ * bank is left selected.
+ */
+void *_xmem_slide_down (uint8_t bank, void *ptr) {
+    struct bank_heap_state *bs = _xmem_heap_state(bank);
+    uint16_t block, header, size, prev, psize, next, nheader;
+
+    if (bank != XMEM_COMMON) {
+        xmem_switch_bank(bank);
+    }
+
+    block = XMEM_ADDR(ptr) - XMEM_BLOCK_HEADER;
+    header = _xmem_peek(block);
+    if (!(header & XMEM_BLOCK_PREV_FREE)) {
+        return ptr;
+    }
+
+    size = header & ~XMEM_BLOCK_FLAGS;
+    psize = _xmem_peek(block - XMEM_BLOCK_FOOTER);
+    prev = block - psize;
+    _xmem_remove_block(bs, prev, psize);
+
+    memmove(XMEM_PTR(prev + XMEM_BLOCK_HEADER), ptr, size - XMEM_BLOCK_HEADER);
+    _xmem_poke(prev, size);
+
+    /* The free space now sits above the block, merged with what was free there. */
+    next = block + size;
+    nheader = _xmem_peek(next);
+    if (nheader & XMEM_BLOCK_FREE) {
+        _xmem_remove_block(bs, next, nheader & ~XMEM_BLOCK_FLAGS);
+        psize += nheader & ~XMEM_BLOCK_FLAGS;
+    }
+
+    block = prev + size;
+    _xmem_poke(block, psize | XMEM_BLOCK_FREE);
+    _xmem_poke(block + psize - XMEM_BLOCK_FOOTER, psize);
+
+    next = block + psize;
+    _xmem_poke(next, _xmem_peek(next) | XMEM_BLOCK_PREV_FREE);
+
+    _xmem_insert_block(bs, block, psize);
+
+    return XMEM_PTR(prev + XMEM_BLOCK_HEADER);
+}
+
+/**
+ * @docstring
+ * Add every free block of a bank to info, sizes are what xmem_malloc could
+ * hand out of them. The bank has to be selected.
+ */
+static void _xmem_walk_free_list (uint8_t bank, struct xmem_heap_info *info) {
+    struct bank_heap_state *bs = _xmem_heap_state(bank);
+
+    if (!bs->heap_ready) {
+        _xmem_heap_init(bs);
+    }
+
+    for (uint8_t fl = 0; fl < XMEM_FL_COUNT; fl++) {
+        for (uint8_t sl = 0; sl < XMEM_SL_COUNT; sl++) {
+            for (uint16_t block = bs->blocks[fl][sl]; block; block = _xmem_peek(block + XMEM_BLOCK_NEXT)) {
+                _xmem_heap_info_add(info, (_xmem_peek(block) & ~XMEM_BLOCK_FLAGS) - XMEM_BLOCK_HEADER);
+            }
+        }
+    }
+}
+
+#else
+
+/* avr-libc's free list entry, the list starts at __flp and is kept in address order. */
+struct xmem_freelist {
+    size_t sz;                  /* Usable bytes after this field. */
+    struct xmem_freelist *nx;   /* Next free chunk, NULL at the end. */
+};
+
+/**
+ * @docstring
+ * Add every chunk of a bank's avr-libc free list to info, and the space
+ * above __brkval malloc() has not used yet. The bank has to be selected.
+ */
+static void _xmem_walk_free_list (uint8_t bank, struct xmem_heap_info *info) {
+    struct bank_heap_state *bs = _xmem_heap_state(bank);
+    struct xmem_freelist *fp = bs->__flp;
+    char *brkval = bs->__brkval;
+
+    /* The bank the avr-libc globals hold has moved on since it was saved. */
+    if (bank == _heap_bank) {
+        fp = __flp;
+        brkval = __brkval;
+    }
+
+    for (; fp; fp = fp->nx) {
+        _xmem_heap_info_add(info, fp->sz);
+    }
+
+    /* A fresh chunk also needs its size field. */
+    if (brkval && brkval + sizeof(size_t) <= bs->__malloc_heap_end) {
+        info->unused = bs->__malloc_heap_end - brkval + 1 - sizeof(size_t);
+    }
+}
+
+/**
+ * @docstring
+ * Point the avr-libc globals at the heap of a bank, selecting it, or at the
+ * common region's heap. Returns whether the system heap was in place.
+ */
+static uint8_t _xmem_enter_heap (uint8_t bank) {
+    uint8_t system_heap = _system_heap_in_place;
+
+    if (bank != XMEM_COMMON) {
+        xmem_switch_bank(bank);
+    }
+    xmem_set_xmem_heap();
+    _xmem_switch_heap(bank);
+
+    return system_heap;
+}
+
+/**
+ * @docstring
+ * Undo _xmem_enter_heap. The common region's heap is not left in place,
+ * malloc() keeps working on the current bank.
+ */
+static void _xmem_leave_heap (uint8_t bank, uint8_t system_heap) {
+    if (bank == XMEM_COMMON) {
+        _xmem_switch_heap(_current_bank);
+    }
+
+    if (system_heap) {
+        xmem_set_system_heap();
+    }
+}
+
+/**
+ * @docstring
+ * Allocate size bytes in the given bank with avr-libc malloc(). The bank is
+ * left selected so the returned pointer can be used right away.
+ */
+void *xmem_malloc (uint8_t bank, size_t size) {
+    uint8_t system_heap;
+    void *ptr;
+
+    if (!_xmem_heap_exists(bank)) {
+        return NULL;
+    }
+
+    system_heap = _xmem_enter_heap(bank);
+
+    ptr = malloc(size);
+    _xmem_stat_high_water(bank, XMEM_ADDR(__brkval));
+
+    _xmem_leave_heap(bank, system_heap);
+
+    return ptr;
+}
+
+/**
+ * @docstring
+ * Free a block returned by xmem_malloc for the same bank. The bank is left selected.
+ */
+void xmem_free (uint8_t bank, void *ptr) {
+    uint8_t system_heap;
+
+    if (!_xmem_heap_exists(bank)) {
+        return;
+    }
+
+    system_heap = _xmem_enter_heap(bank);
+
+    free(ptr);
+
+    _xmem_leave_heap(bank, system_heap);
+}
+
+/**
+ * @docstring
+ * Move the block at ptr down into the free chunk right below it, if there
+ * is one, and free the space it leaves. Returns where the block is now. The
+ * bank is left selected.
+ */
+void *_xmem_slide_down (uint8_t bank, void *ptr) {
+    uint8_t system_heap = _xmem_enter_heap(bank);
+    char *chunk = (char *)ptr - sizeof(size_t);
+    struct xmem_freelist *fp, *fp2 = NULL, *rest;
+    size_t sz = *(size_t *)chunk;
+    size_t fsz;
+
+    for (fp = __flp; fp && (char *)&fp->nx + fp->sz < chunk; fp = fp->nx) {
+        fp2 = fp;
+    }
+
+    if (fp && (char *)&fp->nx + fp->sz == chunk) {
+        if (fp2) {
+            fp2->nx = fp->nx;
+        } else {
+            __flp = fp->nx;
+        }
+
+        fsz = fp->sz;
+        memmove(&fp->nx, ptr, sz);
+        fp->sz = sz;
+        ptr = &fp->nx;
+
+        /* free() merges what is left with the chunk above or gives it back to __brkval. */
+        rest = (struct xmem_freelist *)((char *)ptr + sz);
+        rest->sz = fsz;
+        free(&rest->nx);
+    }
+
+    _xmem_leave_heap(bank, system_heap);
+
+    return ptr;
+}
+
+#endif /* XMEM_NATIVE_MALLOC */
+
+/**
+ * @docstring
+ * Walk a bank's free list and report how fragmented it is. Only the select
+ * pins change, the previous bank is selected again before returning.
+ */
+void xmem_heap_info (uint8_t bank, struct xmem_heap_info *info) {
+    uint8_t saved = xmem_bank_push();
+    uint16_t largest;
+    uint32_t total;
+
+    memset(info, 0, sizeof(*info));
+
+    if (!_xmem_heap_exists(bank)) {
+        return;
+    }
+
+    /* The common region is there whatever the bank. */
+    if (bank != XMEM_COMMON) {
+        xmem_bank_select(bank);
+    }
+    _xmem_walk_free_list(bank, info);
+    xmem_bank_pop(saved);
+
+    largest = info->largest > info->unused ? info->largest : info->unused;
+    total = (uint32_t)info->free_bytes + info->unused;
+    if (total) {
+        info->fragmentation = 100 - (uint8_t)((uint32_t)largest * 100 / total);
+    }
+}
@@ -0,0 +1,184 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Background memory test.
+ *
+ * Instead of testing every bank before the main loop starts, the idle loop
+ * calls xmem_memtest_step, which tests the next XMEM_COPY_BUFFER bytes and
+ * moves on, going round the common region, the far space and the lower 8KB
+ * of every bank forever. The bytes go XMEM_MEMTEST_CHUNK at a time: saved,
+ * filled and checked with an LFSR pattern and then with another seed, and
+ * put back, with interrupts off so nothing sees the patterns. Interrupts
+ * come back between chunks, so memory in use is tested without holding
+ * handlers back for long. The lower 8KB are reached by unshadowing them like
+ * xmem-low.c does.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#if XMEM_MEMTEST_CHUNK < 1 || XMEM_MEMTEST_CHUNK > 255
+#error "XMEM_MEMTEST_CHUNK should be between 1 and 255."
+#endif
+
+/* Bytes of the common region, tested before the far space. */
+#if XMEM_COMMON_END
+#define XMEM_MEMTEST_COMMON     ((uint16_t)(XMEM_COMMON_END + 1 - XMEM_ADDR(XMEM_START)))
+#else
+#define XMEM_MEMTEST_COMMON     0
+#endif
+
+/* Bytes of the lower memory of every bank, tested after the far space. */
+#define XMEM_MEMTEST_LOW        8192U
+
+static struct xmem_memtest _memtest;
+
+/**
+ * @docstring
+ * Bytes in a sweep.
+ */
+static inline uint32_t _xmem_memtest_size (void) {
+    return XMEM_MEMTEST_COMMON + xmem_far_size() + (uint32_t)XMEM_BANK_COUNT * XMEM_MEMTEST_LOW;
+}
+
+/**
+ * @docstring
+ * Start a new sweep from the beginning and forget past results.
+ */
+void xmem_memtest_reset (void) {
+    memset(&_memtest, 0, sizeof(_memtest));
+}
+
+/**
+ * @docstring
+ * Fill a chunk with the pattern of seed and check it. Returns the first bad
+ * byte, NULL if there is none.
+ */
+static inline uint8_t *_xmem_memtest_pass (uint8_t bank, uint8_t *start, uint8_t *end, uint16_t seed) {
+    xmem_fill_pattern(bank, start, end, seed);
+
+    /* Have the host model write the pattern through to its chip. */
+    XMEM_HOST_REMAP();
+
+    return xmem_verify_pattern(bank, start, end, seed);
+}
+
+/**
+ * @docstring
+ * Test n bytes from start in a bank, or in its unshadowed lower memory with
+ * low, and put them back, all with interrupts off. Only the select pins and
+ * XMCRB change, the interrupted code finds its bank as it left it. Returns
+ * the first bad byte, NULL if there is none.
+ */
+static uint8_t *_xmem_memtest_chunk (uint8_t bank, uint8_t low, uint8_t *start, uint8_t n, uint16_t seed) {
+    uint8_t saved[XMEM_MEMTEST_CHUNK];
+    struct xmem_mapping mapping;
+    uint8_t sreg = SREG;
+    uint8_t *bad;
+
+    cli();
+    _xmem_reach(&mapping, bank, low);
+
+    memcpy(saved, start, n);
+
+    bad = _xmem_memtest_pass(bank, start, start + n - 1, seed);
+    if (bad == NULL) {
+        bad = _xmem_memtest_pass(bank, start, start + n - 1, ~seed);
+    }
+
+    memcpy(start, saved, n);
+    XMEM_HOST_REMAP();
+
+    _xmem_leave(&mapping);
+    SREG = sreg;
+
+    return bad;
+}
+
+/**
+ * @docstring
+ * Test the next XMEM_COPY_BUFFER bytes at most, never across the end of a
+ * bank or of its lower memory, and keep their contents. Returns 1 if they
+ * are fine, 0 if they are not.
+ */
+uint8_t xmem_memtest_step (void) {
+    uint32_t size = _xmem_memtest_size();
+    uint32_t offset = _memtest.tested;
+    uint32_t far_end = XMEM_MEMTEST_COMMON + xmem_far_size();
+    uint8_t bank = XMEM_COMMON;
+    uint8_t low = 0;
+    uint8_t *start, *bad = NULL;
+    uint16_t n, run;
+
+#if XMEM_COMMON_END
+    if (offset < XMEM_MEMTEST_COMMON) {
+        start = (uint8_t *)XMEM_START + offset;
+        run = XMEM_MEMTEST_COMMON - offset;
+    } else
+#endif
+    if (offset < far_end) {
+        xmem_far_t far = xmem_far_add(XMEM_FAR_START, offset - XMEM_MEMTEST_COMMON);
+
+        bank = XMEM_FAR_BANK(far);
+        start = XMEM_PTR(XMEM_FAR_ADDR(far));
+        run = XMEM_ADDR(XMEM_END) - XMEM_FAR_ADDR(far) + 1;
+    } else {
+        uint16_t at = (uint16_t)((offset - far_end) % XMEM_MEMTEST_LOW);
+
+        bank = (uint8_t)((offset - far_end) / XMEM_MEMTEST_LOW);
+        low = 1;
+        start = (uint8_t *)XMEM_SHADOWED_START + at;
+        run = XMEM_MEMTEST_LOW - at;
+    }
+
+    n = XMEM_COPY_BUFFER;
+    if (n > run) {
+        n = run;
+    }
+    if (n > size - offset) {
+        n = size - offset;
+    }
+
+    for (uint16_t i = 0; i < n; i += XMEM_MEMTEST_CHUNK) {
+        uint8_t len = n - i < XMEM_MEMTEST_CHUNK ? n - i : XMEM_MEMTEST_CHUNK;
+        uint8_t *found = _xmem_memtest_chunk(bank, low, start + i, len, (uint16_t)((offset + i) >> 4) ^ 0x5a5a);
+
+        if (bad == NULL) {
+            bad = found;
+        }
+    }
+
+    if (bad != NULL) {
+        /* Lower memory failures go by their address in the chip. */
+        if (low) {
+            bad -= XMEM_ADDR(XMEM_SHADOWED_START);
+        }
+        if (_memtest.failures++ == 0) {
+            _memtest.first_failure = XMEM_FAR(bank, bad);
+        }
+    }
+
+    _memtest.tested += n;
+    if (_memtest.tested >= size) {
+        _memtest.tested = 0;
+        _memtest.sweeps++;
+    }
+
+    return bad == NULL;
+}
+
+/**
+ * @docstring
+ * Copy out how far the test got and what it found.
+ */
+void xmem_memtest_status (struct xmem_memtest *status) {
+    *status = _memtest;
+    status->size = _xmem_memtest_size();
+}
@@ -0,0 +1,196 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Double buffering across two banks.
+ *
+ * The producer fills one buffer while the consumer drains the other, then
+ * xmem_pingpong_swap hands the filled one over. The one byte full flag says
+ * who owns the second buffer: the producer only sets it and the consumer
+ * only clears it, so the handover needs no lock and the producer can be an
+ * interrupt handler.
+ *
+ * The consumer selects its buffer's bank with xmem_switch_bank and keeps it,
+ * the producer only reaches its own bank through _xmem_reach, which drives
+ * the pins to it even when it interrupts a switch that has already set
+ * _current_bank, and puts the consumer's bank back, so with the buffers in
+ * two banks neither side ever moves the other off its memory.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+/* Keep the compiler from moving the buffer accesses past a flag store. */
+#define XMEM_PINGPONG_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+/**
+ * @docstring
+ * Biggest block xmem_malloc can give in a bank right now.
+ */
+static uint16_t _xmem_pingpong_room (uint8_t bank) {
+    struct xmem_heap_info info;
+
+    xmem_heap_info(bank, &info);
+
+    return info.largest > info.unused ? info.largest : info.unused;
+}
+
+/**
+ * @docstring
+ * Take a size bytes buffer from bank_a and another from bank_b. Size 0
+ * takes about the biggest size both banks have room for, which for a
+ * partial last bank ends at XMEM_LAST_BANK_END. Returns 0 if there's no
+ * room.
+ */
+uint8_t xmem_pingpong_init (struct xmem_pingpong *pp, uint8_t bank_a, uint8_t bank_b, uint16_t size) {
+    uint8_t fit = size == 0;
+    void *a, *b = NULL;
+
+    if (fit) {
+        uint16_t room = _xmem_pingpong_room(bank_b);
+
+        size = _xmem_pingpong_room(bank_a);
+        if (bank_a == bank_b) {
+            size /= 2;
+        } else if (room < size) {
+            size = room;
+        }
+    }
+
+    /* The allocators may not hand out all of their largest block, the
+       native one rounds up to a size class, so shrink until it fits. */
+    while (size) {
+        a = xmem_malloc(bank_a, size);
+        if (a != NULL && (b = xmem_malloc(bank_b, size)) != NULL) {
+            break;
+        }
+        if (a != NULL) {
+            xmem_free(bank_a, a);
+        }
+        if (!fit) {
+            return 0;
+        }
+        size -= size / 16 + 1;
+    }
+
+    if (size == 0) {
+        return 0;
+    }
+
+    pp->data[0] = XMEM_ADDR(a);
+    pp->data[1] = XMEM_ADDR(b);
+    pp->bank[0] = bank_a;
+    pp->bank[1] = bank_b;
+    pp->size = size;
+    pp->fill = 0;
+    pp->ready = 0;
+    pp->side = 0;
+    pp->full = 0;
+
+    return 1;
+}
+
+/**
+ * @docstring
+ * Give both buffers back to their banks.
+ */
+void xmem_pingpong_free (struct xmem_pingpong *pp) {
+    xmem_free(pp->bank[0], XMEM_PTR(pp->data[0]));
+    xmem_free(pp->bank[1], XMEM_PTR(pp->data[1]));
+    pp->size = 0;
+}
+
+/**
+ * @docstring
+ * Producer side. Hand the filled buffer to the consumer and start on the
+ * other one. Returns 0 if the consumer has not released the other one yet
+ * or there is nothing to hand over.
+ */
+uint8_t xmem_pingpong_swap (struct xmem_pingpong *pp) {
+    if (pp->full || pp->fill == 0) {
+        return 0;
+    }
+
+    pp->ready = pp->fill;
+    pp->fill = 0;
+    pp->side ^= 1;
+    XMEM_PINGPONG_BARRIER();
+    pp->full = 1;
+
+    return 1;
+}
+
+/**
+ * @docstring
+ * Producer side. Copy len bytes from src to the producer's buffer, swapping
+ * as soon as it is full. Returns how many bytes went in, fewer than len if
+ * both buffers are full, which means the consumer fell behind. src has to
+ * be in internal memory or the common region. The current bank is left as
+ * it was, so interrupt handlers can write.
+ */
+uint16_t xmem_pingpong_write (struct xmem_pingpong *pp, const void *src, uint16_t len) {
+    const uint8_t *from = src;
+    uint16_t done = 0;
+
+    while (done < len) {
+        uint8_t side = pp->side;
+        uint16_t n = pp->size - pp->fill;
+        struct xmem_mapping saved;
+
+        if (n == 0) {
+            if (!xmem_pingpong_swap(pp)) {
+                break;
+            }
+            continue;
+        }
+
+        if (n > len - done) {
+            n = len - done;
+        }
+
+        _xmem_reach(&saved, pp->bank[side], 0);
+        memcpy((uint8_t *)XMEM_PTR(pp->data[side]) + pp->fill, from + done, n);
+        _xmem_leave(&saved);
+
+        pp->fill += n;
+        done += n;
+    }
+
+    return done;
+}
+
+/**
+ * @docstring
+ * Consumer side. Select the bank of the buffer handed over by the last swap
+ * and return a pointer to it, with the bytes it holds in len. NULL if the
+ * producer has not swapped since the last release.
+ */
+void *xmem_pingpong_acquire (struct xmem_pingpong *pp, uint16_t *len) {
+    uint8_t side;
+
+    if (!pp->full) {
+        return NULL;
+    }
+
+    XMEM_PINGPONG_BARRIER();
+    side = pp->side ^ 1;
+    *len = pp->ready;
+    xmem_switch_bank(pp->bank[side]);
+
+    return XMEM_PTR(pp->data[side]);
+}
+
+/**
+ * @docstring
+ * Consumer side. Give the buffer from xmem_pingpong_acquire back to the
+ * producer, it must not be used anymore.
+ */
+void xmem_pingpong_release (struct xmem_pingpong *pp) {
+    XMEM_PINGPONG_BARRIER();
+    pp->full = 0;
+}
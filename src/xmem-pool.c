@@ -0,0 +1,116 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Fixed size object pools.
+ *
+ * A pool is a slab of count objects taken from a bank with xmem_malloc. Freed
+ * objects are kept in an intrusive list threaded through their first two
+ * bytes, objects never handed out are taken in order from the end of the
+ * used part of the slab, so creating, allocating and freeing are all O(1)
+ * and objects carry no header.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <stdlib.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+
+static struct xmem_pool _pools[XMEM_POOLS];
+
+/**
+ * @docstring
+ * Create a pool of count objects of obj_size bytes in the given bank.
+ * Returns NULL if there's no free pool slot or the bank has no room.
+ */
+struct xmem_pool *xmem_pool_create (uint8_t bank, uint16_t obj_size, uint16_t count) {
+    struct xmem_pool *pool = NULL;
+    uint32_t size;
+
+    /* Freed objects have to hold the free list link. */
+    if (obj_size < sizeof(uint16_t)) {
+        obj_size = sizeof(uint16_t);
+    }
+
+    size = (uint32_t)obj_size * count;
+    if (count == 0 || size > 0xffff) {
+        return NULL;
+    }
+
+    for (uint8_t i = 0; i < XMEM_POOLS; i++) {
+        if (_pools[i].obj_size == 0) {
+            pool = &_pools[i];
+            break;
+        }
+    }
+
+    if (pool == NULL) {
+        return NULL;
+    }
+
+    pool->slab = xmem_malloc(bank, (size_t)size);
+    if (pool->slab == NULL) {
+        return NULL;
+    }
+
+    pool->bank = bank;
+    pool->obj_size = obj_size;
+    pool->free_list = 0;
+    pool->fresh = XMEM_ADDR(pool->slab);
+    pool->fresh_left = count;
+
+    return pool;
+}
+
+/**
+ * @docstring
+ * Give the slab back to its bank. Objects from the pool must not be used anymore.
+ */
+void xmem_pool_destroy (struct xmem_pool *pool) {
+    xmem_free(pool->bank, pool->slab);
+    pool->obj_size = 0;
+}
+
+/**
+ * @docstring
+ * Take an object from the pool and leave its bank selected. Returns NULL
+ * if every object is in use.
+ */
+void *xmem_pool_alloc (struct xmem_pool *pool) {
+    uint16_t obj;
+
+    xmem_switch_bank(pool->bank);
+
+    if (pool->free_list) {
+        obj = pool->free_list;
+        pool->free_list = *(uint16_t *)XMEM_PTR(obj);
+
+        return XMEM_PTR(obj);
+    }
+
+    if (pool->fresh_left == 0) {
+        return NULL;
+    }
+
+    obj = pool->fresh;
+    pool->fresh += pool->obj_size;
+    pool->fresh_left--;
+
+    return XMEM_PTR(obj);
+}
+
+/**
+ * @docstring
+ * Return an object to its pool. The pool's bank is left selected.
+ */
+void xmem_pool_free (struct xmem_pool *pool, void *obj) {
+    if (obj == NULL) {
+        return;
+    }
+
+    xmem_switch_bank(pool->bank);
+
+    *(uint16_t *)obj = pool->free_list;
+    pool->free_list = XMEM_ADDR(obj);
+}
@@ -0,0 +1,289 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Library internals shared between the source files. Not for users.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#ifndef XMEM_PRIVATE_H_INCLUDED
+#define XMEM_PRIVATE_H_INCLUDED
+
+#include <stdint.h>
+
+/* If memory is not a multiple of 64KB we need to find out what's the last bank size.
+   With XMEM_RUNTIME_CONFIG xmem_init_ex works both out. */
+#if XMEM_RUNTIME_CONFIG
+#define XMEM_BANK_COUNT     _xmem_banks
+#define XMEM_LAST_BANK_END  XMEM_PTR(_xmem_last_bank_end)
+#else
+#define XMEM_BANK_COUNT     XMEM_BANKS
+#if (XMEM_TOTAL_MEMORY % 65536) == 0
+#define XMEM_LAST_BANK_END  XMEM_PTR(0xffff)
+#else
+#define XMEM_LAST_BANK_END  XMEM_PTR((XMEM_TOTAL_MEMORY % 65536) - 1)
+#endif
+#endif
+
+/* Atmega XMEM address space block */
+#define XMEM_START      XMEM_PTR(0x2200)
+#define XMEM_END        XMEM_PTR(0xffff)
+
+/* Start of the banked part of the window. */
+#define XMEM_BANK_START XMEM_PTR(XMEM_BANKED_START)
+
+/* Heap bounds in every bank, clipped to XMEM_HEAP_SECTOR. With a common
+   region the bank heaps start above it and it gets its own heap. */
+#if XMEM_COMMON_END
+#if XMEM_HEAP_SECTOR != XMEM_SECTOR_BOTH
+#error "XMEM_COMMON_END needs XMEM_HEAP_SECTOR XMEM_SECTOR_BOTH."
+#endif
+#define XMEM_HEAP_START     XMEM_BANK_START
+#define XMEM_HEAP_END       XMEM_END
+#define XMEM_COMMON_HEAP_END XMEM_PTR(XMEM_COMMON_END)
+#elif XMEM_HEAP_SECTOR == XMEM_SECTOR_LOWER
+#if XMEM_SECTOR_LIMIT == 0
+#error "There is no lower sector with XMEM_SECTOR_LIMIT 0."
+#endif
+#define XMEM_HEAP_START     XMEM_START
+#define XMEM_HEAP_END       XMEM_PTR(XMEM_SECTOR_BOUNDARY - 1)
+#elif XMEM_HEAP_SECTOR == XMEM_SECTOR_UPPER
+#if XMEM_SECTOR_LIMIT == 7
+#error "There is no upper sector with XMEM_SECTOR_LIMIT 7."
+#endif
+#define XMEM_HEAP_START     (XMEM_SECTOR_LIMIT ? XMEM_PTR(XMEM_SECTOR_BOUNDARY) : XMEM_START)
+#define XMEM_HEAP_END       XMEM_END
+#else
+#define XMEM_HEAP_START     XMEM_START
+#define XMEM_HEAP_END       XMEM_END
+#endif
+
+/* Addressable bytes in a full bank. */
+#define XMEM_BANK_SIZE  ((uint16_t)(XMEM_ADDR(XMEM_END) - XMEM_ADDR(XMEM_BANK_START) + 1))
+
+/* The address space to use for unshadowed memory */
+#define XMEM_SHADOWED_START XMEM_PTR(0x8000)
+#define XMEM_SHADOWED_END   XMEM_PTR(0x9fff)
+
+/* High address pins the memory does not need, as the XMM bits of XMCRB. Pins
+   are released from PC7 down and can be used as regular IO. */
+#if XMEM_TOTAL_MEMORY > 32768
+#define XMEM_XMM        0
+#elif XMEM_TOTAL_MEMORY > 16384
+#define XMEM_XMM        1
+#elif XMEM_TOTAL_MEMORY > 8192
+#define XMEM_XMM        2
+#elif XMEM_TOTAL_MEMORY > 4096
+#define XMEM_XMM        3
+#elif XMEM_TOTAL_MEMORY > 2048
+#define XMEM_XMM        4
+#elif XMEM_TOTAL_MEMORY > 1024
+#define XMEM_XMM        5
+#elif XMEM_TOTAL_MEMORY > 256
+#define XMEM_XMM        6
+#else
+#define XMEM_XMM        7
+#endif
+
+/* XMM value that leaves 13 address lines, so 0x8000 reaches the lower 8KB. */
+#define XMEM_XMM_LOW    3
+
+/* XMM bits in XMCRB and the PORTC pins a XMM value releases. */
+#define XMEM_XMM_MASK           (_BV(XMM2) | _BV(XMM1) | _BV(XMM0))
+#define XMEM_XMM_PINS(xmm_)     ((xmm_) == 7 ? 0xff : (uint8_t)(0xff00 >> (xmm_)))
+
+/* Only the host model needs to know when the address decoding changes. */
+#ifndef XMEM_HOST_REMAP
+#define XMEM_HOST_REMAP() ((void) 0)
+#endif
+
+/* Native allocator size classes. Blocks are at least 8 bytes (1 << XMEM_FL_MIN),
+   every power of two is split in XMEM_SL_COUNT linear classes. */
+#define XMEM_SL_BITS    2
+#define XMEM_SL_COUNT   (1 << XMEM_SL_BITS)
+#define XMEM_FL_MIN     3
+#define XMEM_FL_COUNT   (16 - XMEM_FL_MIN)
+
+struct bank_heap_state {
+    void *__brkval;             /* Pointer between __malloc_heap_start and __malloc_heap_end, shows growth. */
+    void *__flp;                /* Pointer to the free block list that malloc handles. */
+    char *__malloc_heap_start;  /* Pointer to the beginning of the heap. */
+    char *__malloc_heap_end;    /* Pointer to the end of the heap, 0 if the heap is below the stack. */
+#if XMEM_NATIVE_MALLOC
+    uint8_t heap_ready;                             /* The free block covering the bank has been laid out. */
+    uint16_t fl_bitmap;                             /* Bit set for every first level with free blocks. */
+    uint8_t sl_bitmap[XMEM_FL_COUNT];               /* Bit set for every second level class with free blocks. */
+    uint16_t blocks[XMEM_FL_COUNT][XMEM_SL_COUNT];  /* Address of the first free block in every class, 0 if none. */
+#endif
+};
+
+/* Private heap variables */
+#ifdef __cplusplus
+extern "C" {
+#endif
+    extern void *__flp;
+    extern void *__brkval;
+#ifdef __cplusplus
+}
+#endif
+
+extern struct bank_heap_state _system_heap_state;
+#if XMEM_RUNTIME_CONFIG
+extern struct bank_heap_state *_bank_state;
+#else
+extern struct bank_heap_state _bank_state[XMEM_BANKS];
+#endif
+#if XMEM_COMMON_END
+extern struct bank_heap_state _common_state;
+#endif
+extern uint8_t _system_heap_in_place;
+extern uint8_t _current_bank;
+extern uint8_t _heap_bank;
+extern uint8_t _xmem_xmm;
+extern uint8_t _copy_buffer[XMEM_COPY_BUFFER];
+#if XMEM_RUNTIME_CONFIG
+extern uint8_t _xmem_banks;
+extern uint16_t _xmem_last_bank_end;
+#endif
+#if XMEM_LAZY_BANK_INIT
+extern uint8_t _bank_ready[(XMEM_BANKS + 7) / 8];
+#endif
+
+#if XMEM_LOW_HEAP
+#define XMEM_LOW_SIZE       8192
+#define XMEM_LOW_GRANULE    64
+#define XMEM_LOW_GRANULES   (XMEM_LOW_SIZE / XMEM_LOW_GRANULE)
+
+struct low_heap {
+    uint8_t used[XMEM_LOW_GRANULES / 8];    /* Bit set for every granule in a block. */
+    uint8_t start[XMEM_LOW_GRANULES / 8];   /* Bit set for the first granule of every block. */
+};
+
+#if XMEM_RUNTIME_CONFIG
+extern struct low_heap *_low_heap;
+#else
+extern struct low_heap _low_heap[XMEM_BANKS];
+#endif
+#endif
+
+void _xmem_switch_heap (uint8_t bank);
+void _xmem_init_bank_state (uint8_t bank);
+void *_xmem_slide_down (uint8_t bank, void *ptr);
+
+/**
+ * @docstring
+ * Copy n bytes, eight at a time so the loop overhead is paid once every
+ * eight ld/st pairs. Used for the bank to bank copies and the streams.
+ */
+static inline void _xmem_copy (uint8_t *dst, const uint8_t *src, uint16_t n) {
+    uint16_t blocks = n >> 3;
+
+    while (blocks--) {
+        *dst++ = *src++; *dst++ = *src++; *dst++ = *src++; *dst++ = *src++;
+        *dst++ = *src++; *dst++ = *src++; *dst++ = *src++; *dst++ = *src++;
+    }
+
+    n &= 7;
+    while (n--) {
+        *dst++ = *src++;
+    }
+}
+
+/**
+ * @docstring
+ * True for the banks xmem_malloc can allocate from, XMEM_COMMON included.
+ */
+static inline uint8_t _xmem_heap_exists (uint8_t bank) {
+    return bank < XMEM_BANK_COUNT || (XMEM_COMMON_END && bank == XMEM_COMMON);
+}
+
+/**
+ * @docstring
+ * Heap state of a bank or of the common region.
+ */
+static inline struct bank_heap_state *_xmem_heap_state (uint8_t bank) {
+#if XMEM_COMMON_END
+    if (bank == XMEM_COMMON) {
+        return &_common_state;
+    }
+#endif
+
+#if XMEM_LAZY_BANK_INIT
+    /* Banks get their heap state the first time it's needed. */
+    if (!(_bank_ready[bank >> 3] & _BV(bank & 7))) {
+        _xmem_init_bank_state(bank);
+    }
+#endif
+
+    return &_bank_state[bank];
+}
+
+/* What _xmem_reach changed, for _xmem_leave. */
+struct xmem_mapping {
+    uint8_t bank;       /* Bank of the code that was running, from xmem_bank_push. */
+    uint8_t xmcrb;      /* Its XMCRB, the lower memory may have been unshadowed. */
+    uint8_t moved;      /* The mapping had to change. */
+};
+
+/**
+ * @docstring
+ * Make the memory of a bank, or its lower 8KB with low, reachable from code
+ * that may have interrupted a bank switch or an unshadowed copy. Only the
+ * select pins and XMCRB change, never the heap state. The pins are always
+ * driven, a bank switch sets _current_bank before them so it can't tell
+ * where they are. XMEM_COMMON is reachable from any bank.
+ */
+static inline void _xmem_reach (struct xmem_mapping *saved, uint8_t bank, uint8_t low) {
+    saved->bank = xmem_bank_push();
+    saved->xmcrb = XMCRB;
+    saved->moved = low || (saved->xmcrb & XMEM_XMM_MASK) != (uint8_t)(_xmem_xmm << XMM0);
+
+    if (bank != XMEM_COMMON) {
+        xmem_bank_select(bank);
+    }
+
+    if (!saved->moved) {
+        return;
+    }
+
+    if (low) {
+        xmem_unshadow_lower_memory();
+    } else {
+        xmem_shadow_lower_memory();
+    }
+}
+
+/**
+ * @docstring
+ * Give back the bank and mapping _xmem_reach found.
+ */
+static inline void _xmem_leave (const struct xmem_mapping *saved) {
+    if (saved->moved) {
+        XMCRB = saved->xmcrb;
+        XMEM_HOST_REMAP();
+    }
+    xmem_bank_pop(saved->bank);
+}
+
+#if XMEM_STATS
+extern struct xmem_stats _stats;
+#if XMEM_RUNTIME_CONFIG
+extern uint16_t *_bank_high_water;
+#else
+extern uint16_t _bank_high_water[XMEM_BANKS];
+#endif
+
+#define XMEM_STAT_INC(counter_)     (_stats.counter_++)
+
+/* Remember the highest heap address used in a bank. */
+static inline void _xmem_stat_high_water (uint8_t bank, uint16_t addr) {
+    if (bank < XMEM_BANK_COUNT && addr > _bank_high_water[bank]) {
+        _bank_high_water[bank] = addr;
+    }
+}
+#else
+#define XMEM_STAT_INC(counter_)     ((void) 0)
+#define _xmem_stat_high_water(bank_, addr_) ((void) 0)
+#endif
+
+#endif /* XMEM_PRIVATE_H_INCLUDED */
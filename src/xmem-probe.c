@@ -0,0 +1,127 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Memory size probe.
+ *
+ * Address lines and bank select lines that reach no memory make addresses
+ * alias: a 32KB chip answers 0xA200 with the byte at 0x2200, a 128KB board
+ * answers bank 2 with bank 0. The probe writes a byte at 0x2200 and looks for
+ * it where it should not be. Every byte it touches is put back.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#define XMEM_PROBE_ADDR         0x2200
+#define XMEM_PROBE_TAG_ADDR     XMEM_BANKED_START
+#define XMEM_PROBE_TAG(bank_)   (0xA5 ^ (bank_))
+
+/**
+ * @docstring
+ * Size of the memory behind the current bank, 8KB to 64KB, found by writing
+ * 8KB, 16KB and 32KB above XMEM_PROBE_ADDR. 0 if nothing reads back.
+ */
+static uint32_t _xmem_probe_bank_size (void) {
+    volatile uint8_t *ref = XMEM_PTR(XMEM_PROBE_ADDR);
+    uint8_t saved = *ref;
+    uint32_t size;
+
+    for (size = 0x2000; size < 0x10000; size <<= 1) {
+        volatile uint8_t *alias = XMEM_PTR(XMEM_PROBE_ADDR + size);
+        uint8_t old = *alias;
+        uint8_t found;
+
+        *ref = 0x55;
+        *alias = 0xAA;
+        XMEM_HOST_REMAP();
+        found = *ref;
+
+        /* If they are the same byte old is saved, so this order works both ways. */
+        *alias = old;
+        *ref = saved;
+        XMEM_HOST_REMAP();
+
+        if (found == 0xAA) {
+            return size;
+        }
+        if (found != 0x55) {
+            return 0;
+        }
+    }
+
+    return size;
+}
+
+/**
+ * @docstring
+ * True if banks 0 up to last still hold their tags.
+ */
+static uint8_t _xmem_probe_tags_intact (uint8_t last) {
+    volatile uint8_t *ref = XMEM_PTR(XMEM_PROBE_TAG_ADDR);
+
+    for (uint8_t bank = 0; bank <= last; bank++) {
+        XMEM_SELECT_BANK(bank);
+        if (*ref != XMEM_PROBE_TAG(bank)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/**
+ * @docstring
+ * Find out how many bytes of external memory there are, up to
+ * XMEM_BANKS * 64KB. Banks are tagged one by one at XMEM_BANKED_START until
+ * a tag lands on an earlier bank or doesn't read back. Memory below 64KB is measured in powers
+ * of two. Returns 0 if nothing answers at 0x2200.
+ */
+uint32_t xmem_probe (void) {
+    volatile uint8_t *ref = XMEM_PTR(XMEM_PROBE_TAG_ADDR);
+    uint8_t saved[XMEM_BANKS];
+    uint8_t xmcrb = XMCRB;
+    uint8_t banks = 0;
+    uint8_t tagged = 0;
+    uint32_t size;
+
+    /* Every address pin, or the high addresses alias by themselves. */
+    XMCRB = xmcrb & ~XMEM_XMM_MASK;
+    XMEM_HOST_REMAP();
+    XMEM_SELECT_BANK(0);
+
+    size = _xmem_probe_bank_size();
+
+    if (size == 0x10000) {
+        for (banks = 0; banks < XMEM_BANKS; banks++) {
+            XMEM_SELECT_BANK(banks);
+            saved[banks] = *ref;
+            *ref = XMEM_PROBE_TAG(banks);
+            tagged = banks + 1;
+
+            if (!_xmem_probe_tags_intact(banks)) {
+                break;
+            }
+        }
+
+        /* Bank 0 last, an aliasing bank wrote its tag there. */
+        while (tagged--) {
+            XMEM_SELECT_BANK(tagged);
+            *ref = saved[tagged];
+        }
+
+        size = (uint32_t)banks * 0x10000;
+    }
+
+    if (_current_bank < XMEM_BANKS) {
+        XMEM_SELECT_BANK(_current_bank);
+    }
+    XMCRB = xmcrb;
+    XMEM_HOST_REMAP();
+
+    return size;
+}
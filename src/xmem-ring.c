@@ -0,0 +1,221 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Single producer single consumer rings.
+ *
+ * The ring bytes live in a bank, the common region or a low block, the ring
+ * itself and its indexes in internal memory. head and tail count bytes and
+ * wrap at 64KB, the ring size is a power of two up to 32KB so head - tail
+ * is always the fill level. The producer only writes head and the consumer
+ * only writes tail, each after its bytes are copied, so one side can be an
+ * interrupt handler without any lock.
+ *
+ * The AVR stores 16 bit values one byte at a time. The other side's index
+ * is read until two reads agree, an index is stored with interrupts off for
+ * the two stores, which in a handler they are anyway.
+ *
+ * A copy into a ring of another bank goes through _xmem_reach, so it can
+ * interrupt a bank switch or a xmem_low_read. The heap state is never
+ * touched.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+/* Keep the compiler from moving the byte copies past an index store. */
+#define XMEM_RING_BARRIER() __asm__ __volatile__ ("" ::: "memory")
+
+/**
+ * @docstring
+ * Read an index the other side may be storing.
+ */
+static inline uint16_t _xmem_ring_load (const volatile uint16_t *index) {
+    uint16_t value;
+
+    do {
+        value = *index;
+    } while (value != *index);
+
+    return value;
+}
+
+/**
+ * @docstring
+ * Store an index so the other side never sees half of it.
+ */
+static inline void _xmem_ring_store (volatile uint16_t *index, uint16_t value) {
+    uint8_t sreg = SREG;
+
+    XMEM_RING_BARRIER();
+    cli();
+    *index = value;
+    SREG = sreg;
+}
+
+/**
+ * @docstring
+ * Copy len bytes between mem and the ring, starting pos bytes into it and
+ * wrapping at its end. mem has to be in internal memory or the common
+ * region when the ring is in another bank or a low block.
+ */
+static void _xmem_ring_copy (const struct xmem_ring *ring, uint16_t pos, uint8_t *mem, uint16_t len, uint8_t write) {
+    uint8_t *data = XMEM_PTR(ring->data);
+    uint16_t first = ring->mask + 1 - pos;
+    struct xmem_mapping saved;
+
+    if (first > len) {
+        first = len;
+    }
+
+    _xmem_reach(&saved, ring->bank, ring->low);
+
+    if (write) {
+        memcpy(data + pos, mem, first);
+        memcpy(data, mem + first, len - first);
+    } else {
+        memcpy(mem, data + pos, first);
+        memcpy(mem + first, data, len - first);
+    }
+
+    _xmem_leave(&saved);
+}
+
+/**
+ * @docstring
+ * Set up an empty ring around size bytes at data.
+ */
+static void _xmem_ring_setup (struct xmem_ring *ring, uint8_t bank, uint16_t data, uint16_t size, uint8_t low) {
+    ring->data = data;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->bank = bank;
+    ring->low = low;
+}
+
+/**
+ * @docstring
+ * True for the ring sizes that work: powers of two from 2 up to 32KB.
+ */
+static inline uint8_t _xmem_ring_size_ok (uint16_t size) {
+    return size >= 2 && size <= 0x8000 && (size & (size - 1)) == 0;
+}
+
+/**
+ * @docstring
+ * Make a ring of size bytes taken from a bank, or the common region with
+ * XMEM_COMMON, with xmem_malloc. Returns 0 if the size is not a power of two
+ * up to 32KB or the bank has no room.
+ */
+uint8_t xmem_ring_init (struct xmem_ring *ring, uint8_t bank, uint16_t size) {
+    void *data;
+
+    if (!_xmem_ring_size_ok(size) || (data = xmem_malloc(bank, size)) == NULL) {
+        return 0;
+    }
+
+    _xmem_ring_setup(ring, bank, XMEM_ADDR(data), size, 0);
+
+    return 1;
+}
+
+/**
+ * @docstring
+ * Make a ring of size bytes in the lower 8KB of a bank with xmem_low_alloc.
+ * Returns 0 without XMEM_LOW_HEAP, for a bad size or if there's no room.
+ */
+uint8_t xmem_ring_init_low (struct xmem_ring *ring, uint8_t bank, uint16_t size) {
+#if XMEM_LOW_HEAP
+    uint16_t block;
+
+    if (_xmem_ring_size_ok(size) && (block = xmem_low_alloc(bank, size)) != 0) {
+        _xmem_ring_setup(ring, bank, block, size, 1);
+        return 1;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * @docstring
+ * Give the ring bytes back. Neither side may use the ring anymore.
+ */
+void xmem_ring_release (struct xmem_ring *ring) {
+#if XMEM_LOW_HEAP
+    if (ring->low) {
+        xmem_low_free(ring->bank, ring->data);
+        ring->data = 0;
+        return;
+    }
+#endif
+
+    xmem_free(ring->bank, XMEM_PTR(ring->data));
+    ring->data = 0;
+}
+
+/**
+ * @docstring
+ * Producer side. Copy len bytes from src into the ring, all of them or none
+ * if they don't fit, so records pushed whole are popped whole. Returns 1 if
+ * they went in. Interrupt handlers can push, the current bank and the
+ * lower memory mapping are left as they were.
+ */
+uint8_t xmem_ring_push (struct xmem_ring *ring, const void *src, uint16_t len) {
+    uint16_t head = ring->head;
+
+    if (len > (uint16_t)(ring->mask + 1 - (head - _xmem_ring_load(&ring->tail)))) {
+        return 0;
+    }
+
+    _xmem_ring_copy(ring, head & ring->mask, (uint8_t *)src, len, 1);
+    _xmem_ring_store(&ring->head, head + len);
+
+    return 1;
+}
+
+/**
+ * @docstring
+ * Consumer side. Copy up to max bytes out of the ring into dst and return
+ * how many. Popping a multiple of the record size keeps records whole.
+ */
+uint16_t xmem_ring_pop (struct xmem_ring *ring, void *dst, uint16_t max) {
+    uint16_t tail = ring->tail;
+    uint16_t len = _xmem_ring_load(&ring->head) - tail;
+
+    if (len > max) {
+        len = max;
+    }
+
+    if (len == 0) {
+        return 0;
+    }
+
+    _xmem_ring_copy(ring, tail & ring->mask, dst, len, 0);
+    _xmem_ring_store(&ring->tail, tail + len);
+
+    return len;
+}
+
+/**
+ * @docstring
+ * Bytes waiting in the ring.
+ */
+uint16_t xmem_ring_count (const struct xmem_ring *ring) {
+    return _xmem_ring_load(&ring->head) - _xmem_ring_load(&ring->tail);
+}
+
+/**
+ * @docstring
+ * Bytes that can still be pushed.
+ */
+uint16_t xmem_ring_space (const struct xmem_ring *ring) {
+    return ring->mask + 1 - xmem_ring_count(ring);
+}
@@ -0,0 +1,56 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Usage counters, kept with XMEM_STATS.
+ *
+ * The counters are bumped where the work happens, with XMEM_STATS off the
+ * XMEM_STAT_INC calls compile to nothing. Free lists are only walked when
+ * someone asks for them.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#if XMEM_STATS
+
+/**
+ * @docstring
+ * Copy the bank switch and heap flip counters.
+ */
+void xmem_get_stats (struct xmem_stats *stats) {
+    *stats = _stats;
+}
+
+/**
+ * @docstring
+ * Heap usage of one bank. Walks the bank's free list, which takes two
+ * pin only bank switches.
+ */
+void xmem_get_bank_stats (uint8_t bank, struct xmem_bank_stats *stats) {
+    struct xmem_heap_info info;
+
+    memset(stats, 0, sizeof(*stats));
+
+    if (bank >= XMEM_BANK_COUNT) {
+        return;
+    }
+
+    /* The bank the avr-libc globals hold has moved on since it was saved. */
+    if (!XMEM_NATIVE_MALLOC && bank == _heap_bank) {
+        _xmem_stat_high_water(bank, XMEM_ADDR(__brkval));
+    }
+
+    xmem_heap_info(bank, &info);
+
+    stats->high_water = _bank_high_water[bank];
+    stats->free_blocks = info.free_blocks;
+    stats->free_bytes = info.free_bytes;
+}
+
+#endif /* XMEM_STATS */
@@ -0,0 +1,110 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Streams over the far space.
+ *
+ * A stream walks a range of the far space in order. Every call moves as
+ * much as it can within the current bank in one go, so the bank is
+ * selected once per bank crossed (and again only if something else selected
+ * another bank between calls), not once per byte like the far pointer
+ * accessors. Bytes are moved eight at a time.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+/**
+ * @docstring
+ * Point the stream at addr in bank.
+ */
+static inline void _xmem_stream_seek (struct xmem_stream *stream, uint8_t bank, uint16_t addr) {
+    stream->bank = bank;
+    stream->addr = addr;
+    stream->run = XMEM_ADDR(XMEM_END) - addr + 1;
+}
+
+/**
+ * @docstring
+ * Move up to n bytes between mem and the stream, a bank at a time.
+ */
+static uint16_t _xmem_stream_move (struct xmem_stream *stream, uint8_t *mem, uint16_t n, uint8_t write) {
+    uint16_t done = 0;
+
+    if (n > stream->left) {
+        n = stream->left;
+    }
+
+    while (done < n) {
+        uint16_t chunk = n - done;
+        uint8_t *data = XMEM_PTR(stream->addr);
+
+        if (chunk > stream->run) {
+            chunk = stream->run;
+        }
+
+        if (_current_bank != stream->bank) {
+            xmem_switch_bank(stream->bank);
+        }
+
+        if (write) {
+            _xmem_copy(data, mem + done, chunk);
+        } else {
+            _xmem_copy(mem + done, data, chunk);
+        }
+
+        done += chunk;
+        stream->left -= chunk;
+
+        if (chunk == stream->run) {
+            _xmem_stream_seek(stream, stream->bank + 1, XMEM_ADDR(XMEM_BANK_START));
+        } else {
+            stream->addr += chunk;
+            stream->run -= chunk;
+        }
+    }
+
+    return done;
+}
+
+/**
+ * @docstring
+ * Start a stream of len bytes at far, cut short at the end of the far space.
+ * A far pointer outside the far space, below XMEM_BANKED_START in any bank
+ * included, gives an empty stream.
+ */
+void xmem_stream_open (struct xmem_stream *stream, xmem_far_t far, uint32_t len) {
+    int32_t offset = xmem_far_diff(far, XMEM_FAR_START);
+    uint32_t size = xmem_far_size();
+
+    if (XMEM_FAR_ADDR(far) < XMEM_ADDR(XMEM_BANK_START) || offset < 0 || (uint32_t)offset >= size) {
+        len = 0;
+    } else if (len > size - (uint32_t)offset) {
+        len = size - (uint32_t)offset;
+    }
+
+    stream->left = len;
+    _xmem_stream_seek(stream, XMEM_FAR_BANK(far), XMEM_FAR_ADDR(far));
+}
+
+/**
+ * @docstring
+ * Read up to n bytes from the stream into buf and return how many, fewer
+ * than n at the end of the range. buf has to be in internal memory or the
+ * common region. The bank of the last byte read is left selected.
+ */
+uint16_t xmem_stream_read (struct xmem_stream *stream, void *buf, uint16_t n) {
+    return _xmem_stream_move(stream, buf, n, 0);
+}
+
+/**
+ * @docstring
+ * Write up to n bytes from buf to the stream, like xmem_stream_read.
+ */
+uint16_t xmem_stream_write (struct xmem_stream *stream, const void *buf, uint16_t n) {
+    return _xmem_stream_move(stream, (uint8_t *)buf, n, 1);
+}
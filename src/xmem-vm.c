@@ -0,0 +1,220 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * Paging of the far pointer space.
+ *
+ * The far linear space is split in XMEM_VM_PAGE_SIZE pages, addressed by
+ * their offset from XMEM_FAR_START. XMEM_VM_FRAMES of them are resident in
+ * frames in internal memory, the common region or a bank (XMEM_VM_FRAME_BANK)
+ * and xmem_vm_ptr hands out plain pointers into them. A page that is not
+ * resident takes the least recently used frame, which goes back to its bank
+ * first if it was written. Pages never cross a bank: XMEM_BANKED_START and
+ * the end of a full bank are multiples of any page size up to 512. Only the
+ * last page can run past the end of the memory, it is copied up to the end
+ * and no further. Frames are moved with xmem_memcpy_far.
+ *
+ * Ages come from a 16 bit clock, so a frame left unused for more than 65535
+ * xmem_vm_ptr calls can look recently used and outlive younger frames. It
+ * only costs extra faults, never wrong data.
+ *
+ * Like far pointers the paged space covers every bank, heaps included.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <string.h>
+#include <avr/io.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+#include "xmem-private.h"
+
+#if XMEM_VM_FRAMES
+
+#if XMEM_VM_PAGE_SIZE & (XMEM_VM_PAGE_SIZE - 1) || XMEM_VM_PAGE_SIZE < 16 || XMEM_VM_PAGE_SIZE > 512
+#error "XMEM_VM_PAGE_SIZE should be a power of two from 16 up to 512."
+#endif
+
+#if XMEM_VM_FRAMES > 255
+#error "XMEM_VM_FRAMES can't go past 255."
+#endif
+
+#define XMEM_VM_OFFSET      (XMEM_VM_PAGE_SIZE - 1)
+
+#define XMEM_VM_VALID       0x01    /* The frame holds a page. */
+#define XMEM_VM_DIRTY       0x02    /* Written since it was paged in. */
+
+struct vm_frame {
+    uint32_t page;      /* Virtual address of the page held. */
+    uint16_t used;      /* _vm_clock when it was last used. */
+    uint8_t flags;      /* XMEM_VM_VALID, XMEM_VM_DIRTY. */
+};
+
+static struct vm_frame _vm_frames[XMEM_VM_FRAMES];
+#if XMEM_VM_FRAME_BANK == XMEM_VM_INTERNAL
+static uint8_t _vm_storage[XMEM_VM_FRAMES * XMEM_VM_PAGE_SIZE];
+static uint8_t *_vm_data = _vm_storage;
+#else
+static uint8_t *_vm_data = NULL;    /* From xmem_malloc on the first fault. */
+#endif
+static uint8_t _vm_last = 0;        /* Frame of the last xmem_vm_ptr call. */
+static uint16_t _vm_clock = 0;
+static struct xmem_vm_stats _vm_stats;
+
+/**
+ * @docstring
+ * Far pointer to a page.
+ */
+static inline xmem_far_t _xmem_vm_far (uint32_t page) {
+    return xmem_far_add(XMEM_FAR_START, (int32_t)page);
+}
+
+/**
+ * @docstring
+ * Bytes of a page that are memory, less than a page only for the last one
+ * of a memory that's not a multiple of the page size.
+ */
+static inline uint16_t _xmem_vm_page_len (uint32_t page) {
+    uint32_t left = xmem_far_size() - page;
+
+    return left < XMEM_VM_PAGE_SIZE ? (uint16_t)left : XMEM_VM_PAGE_SIZE;
+}
+
+/**
+ * @docstring
+ * Write a dirty frame back to its page.
+ */
+static void _xmem_vm_writeback (uint8_t i) {
+    xmem_far_t far = _xmem_vm_far(_vm_frames[i].page);
+
+    xmem_memcpy_far(XMEM_FAR_BANK(far), XMEM_PTR(XMEM_FAR_ADDR(far)), XMEM_VM_FRAME_BANK,
+                    &_vm_data[i * XMEM_VM_PAGE_SIZE], _xmem_vm_page_len(_vm_frames[i].page));
+    _vm_frames[i].flags &= ~XMEM_VM_DIRTY;
+    _vm_stats.writebacks++;
+}
+
+/**
+ * @docstring
+ * Find the frame holding a page, paging it in over the least recently used
+ * frame if it's not resident. Returns 0 if the page is past the end of the
+ * far space or there is no room for the frames.
+ */
+static uint8_t _xmem_vm_fault (uint32_t page, uint8_t *frame) {
+    uint8_t victim = 0;
+    uint16_t oldest = 0;
+    xmem_far_t far;
+
+    for (uint8_t i = 0; i < XMEM_VM_FRAMES; i++) {
+        if ((_vm_frames[i].flags & XMEM_VM_VALID) && _vm_frames[i].page == page) {
+            _vm_stats.hits++;
+            *frame = i;
+            return 1;
+        }
+    }
+
+    if (page >= xmem_far_size()) {
+        return 0;
+    }
+
+#if XMEM_VM_FRAME_BANK != XMEM_VM_INTERNAL
+    if (_vm_data == NULL) {
+        _vm_data = xmem_malloc(XMEM_VM_FRAME_BANK, XMEM_VM_FRAMES * XMEM_VM_PAGE_SIZE);
+        if (_vm_data == NULL) {
+            return 0;
+        }
+    }
+#endif
+
+    /* An empty frame or the one unused for the longest, ages survive the clock wrapping. */
+    for (uint8_t i = 0; i < XMEM_VM_FRAMES; i++) {
+        uint16_t age = _vm_clock - _vm_frames[i].used;
+
+        if (!(_vm_frames[i].flags & XMEM_VM_VALID)) {
+            victim = i;
+            break;
+        }
+        if (age >= oldest) {
+            oldest = age;
+            victim = i;
+        }
+    }
+
+    if (_vm_frames[victim].flags & XMEM_VM_DIRTY) {
+        _xmem_vm_writeback(victim);
+    }
+
+    far = _xmem_vm_far(page);
+    xmem_memcpy_far(XMEM_VM_FRAME_BANK, &_vm_data[victim * XMEM_VM_PAGE_SIZE], XMEM_FAR_BANK(far),
+                    XMEM_PTR(XMEM_FAR_ADDR(far)), _xmem_vm_page_len(page));
+    _vm_frames[victim].page = page;
+    _vm_frames[victim].flags = XMEM_VM_VALID;
+    _vm_stats.faults++;
+
+    *frame = victim;
+    return 1;
+}
+
+/**
+ * @docstring
+ * Pointer to the byte at vaddr in the paged space, valid up to the end of
+ * its page for as long as XMEM_VM_FRAMES other pages have not been used
+ * since. Set write if the page is going to be written so it goes back to
+ * its bank when evicted. With frames in a bank that bank is left selected.
+ * NULL past the end of the far space.
+ */
+void *xmem_vm_ptr (uint32_t vaddr, uint8_t write) {
+    uint32_t page = vaddr & ~(uint32_t)XMEM_VM_OFFSET;
+    struct vm_frame *frame = &_vm_frames[_vm_last];
+
+    if ((frame->flags & XMEM_VM_VALID) && frame->page == page) {
+        _vm_stats.hits++;
+    } else {
+        if (!_xmem_vm_fault(page, &_vm_last)) {
+            return NULL;
+        }
+        frame = &_vm_frames[_vm_last];
+    }
+
+    frame->used = ++_vm_clock;
+    if (write) {
+        frame->flags |= XMEM_VM_DIRTY;
+    }
+
+    if (XMEM_VM_FRAME_BANK < XMEM_BANKS && _current_bank != XMEM_VM_FRAME_BANK) {
+        xmem_switch_bank(XMEM_VM_FRAME_BANK);
+    }
+
+    return &_vm_data[_vm_last * XMEM_VM_PAGE_SIZE + (uint16_t)(vaddr & XMEM_VM_OFFSET)];
+}
+
+/**
+ * @docstring
+ * Write every dirty page back to its bank. Pages stay resident.
+ */
+void xmem_vm_flush (void) {
+    for (uint8_t i = 0; i < XMEM_VM_FRAMES; i++) {
+        if (_vm_frames[i].flags & XMEM_VM_DIRTY) {
+            _xmem_vm_writeback(i);
+        }
+    }
+}
+
+/**
+ * @docstring
+ * Forget every resident page, dirty ones included. Call xmem_vm_flush first
+ * to keep the writes. Frames in a bank are kept.
+ */
+void xmem_vm_invalidate (void) {
+    memset(_vm_frames, 0, sizeof(_vm_frames));
+}
+
+/**
+ * @docstring
+ * Copy the counters out and start counting again.
+ */
+void xmem_vm_stats (struct xmem_vm_stats *stats) {
+    *stats = _vm_stats;
+    memset(&_vm_stats, 0, sizeof(_vm_stats));
+}
+
+#endif /* XMEM_VM_FRAMES */
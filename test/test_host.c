@@ -0,0 +1,1975 @@
+/**
+ * Extended Memory interface for the Atmega2560 MCU.
+ *
+ * The tests from test.c running against the host memory model.
+ *
+ * @author Francisco Soto <francisco@nanosatisfi.com>
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <string.h>
+
+#include "conf_xmem.h"
+#include "atmega2560-xmem.h"
+
+#define p printf
+
+void write_to_bank_of_memory (uint8_t bank, void *from, void *to) {
+    xmem_switch_bank(bank);
+
+    p("Writing bytes from 0x%x to 0x%x on bank %i.\r\n", XMEM_ADDR(from), XMEM_ADDR(to), bank);
+
+    for (uint8_t *i = from; i < ((uint8_t *)to) - 1; i++) {
+        *i = random() % UCHAR_MAX;
+    }
+
+    p("Finished writing to bank %i.\r\n", bank);
+}
+
+int read_from_bank_of_memory (uint8_t bank, void *from, void *to) {
+    xmem_switch_bank(bank);
+
+    p("Checking bytes from 0x%x to 0x%x on bank %i.\r\n", XMEM_ADDR(from), XMEM_ADDR(to), bank);
+
+    for (uint8_t *i = from; i < ((uint8_t *)to) - 1; i++) {
+        uint8_t test = random() % UCHAR_MAX;
+        if (*i != test) {
+            p("Failed read on 0x%x on bank %i. Expected 0x%x and got 0x%x.\r\n", XMEM_ADDR(i), bank, test, *i);
+
+            return -1;
+        }
+    }
+
+    p("Finished checking bank %i.\r\n", bank);
+
+    return 0;
+}
+
+int test_memory_access (void) {
+    p("Memory access test starting...\r\n");
+    p("%i banks, %lu bytes of total memory.\r\n", XMEM_BANKS, (unsigned long)XMEM_TOTAL_MEMORY);
+
+    srandom(12345);
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        write_to_bank_of_memory(bank, xmem_get_current_bank_address_start(), xmem_get_current_bank_address_end());
+    }
+
+    srandom(12345);
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        if (read_from_bank_of_memory(bank, xmem_get_current_bank_address_start(), xmem_get_current_bank_address_end())) {
+            p("Memory access test failed on bank %i\r\n", bank);
+            return -1;
+        }
+    }
+
+    p("Memory access test successful\r\n");
+
+    return 0;
+}
+
+int test_low_memory_access (void) {
+    p("Low memory (first 8KB) access test starting...\r\n");
+    p("%i banks, %lu bytes of total memory.\r\n", XMEM_BANKS, XMEM_BANKS * 8192UL);
+
+    void *ptr = xmem_unshadow_lower_memory();
+
+    srandom(12345);
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        write_to_bank_of_memory(bank, ptr, ((uint8_t *)ptr) + 8191);
+    }
+
+    srandom(12345);
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        if (read_from_bank_of_memory(bank, ptr, ((uint8_t *)ptr) + 8191)) {
+            p("Memory access test failed on bank %i\r\n", bank);
+            xmem_shadow_lower_memory();
+            return -1;
+        }
+    }
+
+    xmem_shadow_lower_memory();
+
+    /* PORTC pins the memory doesn't need for the lower 8KB are left alone. */
+    DDRC = 0;
+    PORTC = 0xff;
+    xmem_unshadow_lower_memory();
+    if (DDRC != 0xe0 || PORTC != 0x1f || (XMCRB & 7) != 3) {
+        p("Unshadowing set DDRC 0x%x PORTC 0x%x XMCRB 0x%x\r\n", DDRC, PORTC, XMCRB);
+        xmem_shadow_lower_memory();
+        return -1;
+    }
+
+    xmem_shadow_lower_memory();
+    if (XMCRB != 0) {
+        p("Shadowing left XMCRB at 0x%x\r\n", XMCRB);
+        return -1;
+    }
+
+    p("Low memory access test successful\r\n");
+
+    return 0;
+}
+
+int test_bank_select (void) {
+#if XMEM_TOTAL_MEMORY > 131072
+    uint8_t mask = XMEM_BANK_MASK(0, XMEM_BANK_BITS);
+    volatile uint8_t *port = &PORTL;
+    uint8_t shift = 0;
+#else
+    uint8_t mask = _BV(7);
+    volatile uint8_t *port = &PORTD;
+    uint8_t shift = 7;
+#endif
+
+    uint8_t saved = *port;
+
+    p("Bank select test starting...\r\n");
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        *port = bank & 1 ? 0x55 : 0xaa;
+        xmem_switch_bank(bank);
+
+        if ((*port & mask) != (uint8_t)(bank << shift) || (*port & ~mask) != ((bank & 1 ? 0x55 : 0xaa) & ~mask)
+            || xmem_host_selected_bank() != bank) {
+            p("Bank %i drove the port to 0x%x\r\n", bank, *port);
+            return -1;
+        }
+    }
+
+    /* There is no bank XMEM_BANKS. */
+    xmem_switch_bank(XMEM_BANKS);
+    if (_current_bank != XMEM_BANKS - 1 || xmem_host_selected_bank() != XMEM_BANKS - 1) {
+        p("Switched to bank %i past the last one\r\n", _current_bank);
+        return -1;
+    }
+
+    xmem_switch_bank(0);
+    *port = saved;
+
+    p("Bank select test successful\r\n");
+
+    return 0;
+}
+
+int test_heap_location (void) {
+    xmem_switch_bank(0);
+    void *external_ptr, *internal_ptr;
+
+    for (uint8_t i = 0; i < 8; i++) {
+        xmem_set_xmem_heap(); xmem_sync_heap(); external_ptr = malloc(1024);
+        xmem_set_system_heap(); internal_ptr = malloc(128);
+        p("Allocation %i: internal pointer located at 0x%x should <0x21ff, external pointer located at 0x%x should be >0x2200\r\n", i, XMEM_ADDR(internal_ptr), XMEM_ADDR(external_ptr));
+
+        if (!internal_ptr || !external_ptr || XMEM_ADDR(internal_ptr) > 0x21ff || XMEM_ADDR(external_ptr) < 0x2200) {
+            return -1;
+        }
+    }
+
+    xmem_set_xmem_heap();
+
+    return 0;
+}
+
+int test_reinit (void) {
+    void *ptr;
+
+    p("Re-init test starting...\r\n");
+
+    /* The second xmem_init finds bank 0's heap in the avr-libc globals. */
+    xmem_init();
+    ptr = xmem_malloc(0, 16);
+    xmem_init();
+
+    xmem_set_system_heap();
+    ptr = malloc(16);
+    p("System heap allocation after a re-init at 0x%x should be <0x2200\r\n", XMEM_ADDR(ptr));
+    if (ptr == NULL || XMEM_ADDR(ptr) >= 0x2200) {
+        xmem_set_xmem_heap();
+        return -1;
+    }
+    free(ptr);
+    xmem_set_xmem_heap();
+
+    xmem_init();
+
+    p("Re-init test successful\r\n");
+
+    return 0;
+}
+
+int test_sectors (void) {
+    uint8_t xmcra = _BV(SRE) | (XMEM_SECTOR_LIMIT << SRL0) | (XMEM_LOWER_WAIT_STATES << SRW00) | (XMEM_WAIT_STATES << SRW10);
+    uint16_t start = XMEM_HEAP_SECTOR == XMEM_SECTOR_UPPER && XMEM_SECTOR_LIMIT ? XMEM_SECTOR_BOUNDARY : XMEM_BANKED_START;
+    uint16_t end = XMEM_HEAP_SECTOR == XMEM_SECTOR_LOWER ? XMEM_SECTOR_BOUNDARY - 1 : 0xffff;
+    void *ptrs[4];
+
+    p("Sector test starting...\r\n");
+
+    xmem_switch_bank(0);
+
+    if (XMCRA != xmcra) {
+        p("XMCRA is 0x%x instead of 0x%x\r\n", XMCRA, xmcra);
+        return -1;
+    }
+
+    if (XMEM_ADDR(xmem_get_current_bank_address_start()) != start || XMEM_ADDR(xmem_get_current_bank_address_end()) != end) {
+        p("Bank 0 heap goes from 0x%x to 0x%x instead of 0x%x to 0x%x\r\n",
+          XMEM_ADDR(xmem_get_current_bank_address_start()), XMEM_ADDR(xmem_get_current_bank_address_end()), start, end);
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < 4; i++) {
+        ptrs[i] = xmem_malloc(0, 2000);
+
+        if (ptrs[i] == NULL || XMEM_ADDR(ptrs[i]) < start || XMEM_ADDR(ptrs[i]) + 2000 - 1 > end) {
+            p("Allocation at 0x%x is outside of the heap sector\r\n", XMEM_ADDR(ptrs[i]));
+            return -1;
+        }
+    }
+
+    for (uint8_t i = 0; i < 4; i++) {
+        xmem_free(0, ptrs[i]);
+    }
+
+    p("Sector test successful\r\n");
+
+    return 0;
+}
+
+int test_calibrate (void) {
+    uint8_t xmcra = XMCRA;
+    uint8_t expect = (2 << SRW10) | (XMEM_SECTOR_LIMIT ? 2 << SRW00 : 0);
+    uint8_t *data = XMEM_PTR(0x2200);
+    uint8_t saved[300];
+    uint8_t ws;
+
+    p("Calibration test starting...\r\n");
+
+    /* The bank 0 heap starts there, put it back when done. */
+    xmem_switch_bank(0);
+    memcpy(saved, data, sizeof(saved));
+    for (uint16_t i = 0; i < sizeof(saved); i++) {
+        data[i] = i * 3;
+    }
+
+    ws = xmem_calibrate();
+    if (ws != 0) {
+        p("Calibration picked 0x%x on a fast chip\r\n", ws);
+        return -1;
+    }
+
+    xmem_host_set_chip_wait_states(2);
+    ws = xmem_calibrate();
+    if (ws != expect || (XMCRA & 0x0f) != expect) {
+        p("Calibration picked 0x%x, XMCRA 0x%x, for a chip that needs 2 wait states\r\n", ws, XMCRA);
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < sizeof(saved); i++) {
+        if (data[i] != (uint8_t)(i * 3)) {
+            p("Calibration left 0x%x at 0x%x\r\n", data[i], XMEM_ADDR(&data[i]));
+            return -1;
+        }
+    }
+
+    xmem_host_set_chip_wait_states(4);
+    if (xmem_calibrate() != XMEM_CALIBRATE_FAILED) {
+        p("Calibration passed a chip that never works\r\n");
+        return -1;
+    }
+
+    xmem_host_set_chip_wait_states(0);
+    XMCRA = xmcra;
+    memcpy(data, saved, sizeof(saved));
+
+    p("Calibration test successful\r\n");
+
+    return 0;
+}
+
+int test_xmem_malloc (void) {
+    uint8_t *ptrs[XMEM_BANKS][32];
+    uint16_t sizes[32];
+
+    p("Bank allocator test starting...\r\n");
+
+    srandom(12345);
+
+    for (uint8_t i = 0; i < 32; i++) {
+        sizes[i] = 1 + random() % 1500;
+    }
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        for (uint8_t i = 0; i < 32; i++) {
+            ptrs[bank][i] = xmem_malloc(bank, sizes[i]);
+            if (!ptrs[bank][i] || XMEM_ADDR(ptrs[bank][i]) < 0x2200) {
+                p("Allocation %i of %u bytes failed on bank %i\r\n", i, sizes[i], bank);
+                return -1;
+            }
+            memset(ptrs[bank][i], bank * 32 + i, sizes[i]);
+        }
+    }
+
+    /* Free every other block, then the rest, checking nothing got trampled. */
+    for (uint8_t pass = 0; pass < 2; pass++) {
+        for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+            xmem_switch_bank(bank);
+
+            for (uint8_t i = pass; i < 32; i += 2) {
+                for (uint16_t j = 0; j < sizes[i]; j++) {
+                    if (ptrs[bank][i][j] != (uint8_t)(bank * 32 + i)) {
+                        p("Block %i on bank %i was overwritten at byte %u\r\n", i, bank, j);
+                        return -1;
+                    }
+                }
+                xmem_free(bank, ptrs[bank][i]);
+            }
+        }
+    }
+
+    /* Everything was merged back, a big block must fit again. */
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        void *big = xmem_malloc(bank, 16384);
+
+        if (!big) {
+            p("Freed memory was not merged on bank %i\r\n", bank);
+            return -1;
+        }
+        xmem_free(bank, big);
+    }
+
+    xmem_switch_bank(0);
+
+    p("Bank allocator test successful\r\n");
+
+    return 0;
+}
+
+/* One pool per bank, as far as the pools go. */
+#define TEST_POOL_BANKS     (XMEM_BANKS < XMEM_POOLS ? XMEM_BANKS : XMEM_POOLS)
+
+int test_xmem_pool (void) {
+    struct xmem_pool *pools[TEST_POOL_BANKS];
+    uint8_t *objs[TEST_POOL_BANKS][100];
+
+    p("Object pool test starting...\r\n");
+
+    for (uint8_t bank = 0; bank < TEST_POOL_BANKS; bank++) {
+        pools[bank] = xmem_pool_create(bank, 24, 100);
+        if (!pools[bank]) {
+            p("Could not create a pool on bank %i\r\n", bank);
+            return -1;
+        }
+    }
+
+    for (uint8_t bank = 0; bank < TEST_POOL_BANKS; bank++) {
+        for (uint8_t i = 0; i < 100; i++) {
+            objs[bank][i] = xmem_pool_alloc(pools[bank]);
+            memset(objs[bank][i], bank ^ i, 24);
+        }
+
+        if (xmem_pool_alloc(pools[bank]) != NULL) {
+            p("Pool on bank %i handed out more objects than it has\r\n", bank);
+            return -1;
+        }
+    }
+
+    /* Recycle half of them, a freed object must come back before running dry. */
+    for (uint8_t bank = 0; bank < TEST_POOL_BANKS; bank++) {
+        for (uint8_t i = 0; i < 100; i += 2) {
+            xmem_pool_free(pools[bank], objs[bank][i]);
+        }
+        for (uint8_t i = 0; i < 100; i += 2) {
+            objs[bank][i] = xmem_pool_alloc(pools[bank]);
+            if (!objs[bank][i]) {
+                p("Pool on bank %i lost freed objects\r\n", bank);
+                return -1;
+            }
+            memset(objs[bank][i], bank ^ i, 24);
+        }
+    }
+
+    for (uint8_t bank = 0; bank < TEST_POOL_BANKS; bank++) {
+        xmem_switch_bank(bank);
+
+        for (uint8_t i = 0; i < 100; i++) {
+            for (uint8_t j = 0; j < 24; j++) {
+                if (objs[bank][i][j] != (bank ^ i)) {
+                    p("Object %i on bank %i was overwritten\r\n", i, bank);
+                    return -1;
+                }
+            }
+        }
+
+        xmem_pool_destroy(pools[bank]);
+    }
+
+    xmem_switch_bank(0);
+
+    p("Object pool test successful\r\n");
+
+    return 0;
+}
+
+int test_far_pointers (void) {
+    uint32_t size = xmem_far_size();
+    xmem_far_t far = XMEM_FAR_START;
+    uint16_t lfsr = 1;
+
+    p("Far pointer test starting, %lu bytes of linear space...\r\n", (unsigned long)size);
+
+    for (uint32_t i = 0; i < size; i++, far = xmem_far_add(far, 1)) {
+        lfsr = XMEM_LFSR(lfsr);
+        xmem_far_write8(far, (uint8_t)lfsr);
+    }
+
+    if (xmem_far_diff(far, XMEM_FAR_START) != (int32_t)size) {
+        p("Linear space does not add up\r\n");
+        return -1;
+    }
+
+    lfsr = 1;
+    far = XMEM_FAR_START;
+    for (uint32_t i = 0; i < size; i++, far = xmem_far_add(far, 1)) {
+        lfsr = XMEM_LFSR(lfsr);
+        if (xmem_far_read8(far) != (uint8_t)lfsr) {
+            p("Failed far read at bank %i 0x%x\r\n", XMEM_FAR_BANK(far), XMEM_FAR_ADDR(far));
+            return -1;
+        }
+    }
+
+    /* Words running past the end of a bank carry into the next one. */
+    for (uint8_t bank = 0; bank + 1 < XMEM_BANKS; bank++) {
+        xmem_far_t edge = XMEM_FAR(bank, XMEM_PTR(0xfffe));
+
+        xmem_far_write32(edge, 0x44332211UL);
+        if (xmem_far_read32(edge) != 0x44332211UL
+            || xmem_far_read16(xmem_far_add(edge, 1)) != 0x3322
+            || xmem_far_read8(XMEM_FAR(bank + 1, XMEM_PTR(XMEM_BANKED_START + 1))) != 0x44
+            || xmem_far_add(XMEM_FAR(bank + 1, XMEM_PTR(XMEM_BANKED_START)), -1) != XMEM_FAR(bank, XMEM_PTR(0xffff))) {
+            p("Far access across banks %i and %i failed\r\n", bank, bank + 1);
+            return -1;
+        }
+    }
+
+    xmem_switch_bank(0);
+
+    p("Far pointer test successful\r\n");
+
+    return 0;
+}
+
+int test_memcpy_far (void) {
+    uint8_t *internal = XMEM_PTR(0x1000);
+
+    p("Far memcpy test starting...\r\n");
+
+    xmem_switch_bank(0);
+    for (uint16_t i = 0; i < 3000; i++) {
+        ((uint8_t *)XMEM_PTR(0x3000))[i] = i * 7;
+    }
+
+    for (uint8_t bank = 1; bank < XMEM_BANKS; bank++) {
+        xmem_memcpy_far(bank, XMEM_PTR(0x5001), 0, XMEM_PTR(0x3000), 3000);
+    }
+
+    /* Bank 0 has to be untouched, every other bank a copy of it. */
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        uint8_t *data = XMEM_PTR(bank ? 0x5001 : 0x3000);
+
+        xmem_switch_bank(bank);
+        for (uint16_t i = 0; i < 3000; i++) {
+            if (data[i] != (uint8_t)(i * 7)) {
+                p("Far memcpy failed on bank %i at byte %u\r\n", bank, i);
+                return -1;
+            }
+        }
+    }
+
+    /* Internal memory is the same for every bank. */
+    xmem_memcpy_far(0, internal, XMEM_BANKS - 1, XMEM_PTR(0x5001), 100);
+    xmem_memcpy_far(XMEM_BANKS - 1, XMEM_PTR(0xff00), 0, internal, 100);
+    for (uint16_t i = 0; i < 100; i++) {
+        if (((uint8_t *)XMEM_PTR(0xff00))[i] != (uint8_t)(i * 7)) {
+            p("Far memcpy through internal memory failed at byte %u\r\n", i);
+            return -1;
+        }
+    }
+
+    xmem_switch_bank(0);
+
+    p("Far memcpy test successful\r\n");
+
+    return 0;
+}
+
+int test_cache (void) {
+    struct xmem_cache_stats stats;
+    uint8_t last = XMEM_BANKS - 1;
+    xmem_far_t far;
+
+    p("Cache test starting...\r\n");
+
+    xmem_cache_invalidate();
+    xmem_cache_stats(&stats);
+
+    for (uint16_t i = 0; i < 64; i++) {
+        xmem_far_write8(XMEM_FAR(0, XMEM_PTR(0x4000 + i)), i);
+        xmem_far_write8(XMEM_FAR(last, XMEM_PTR(0x4000 + i)), ~i);
+    }
+
+    for (uint16_t i = 0; i < 64; i++) {
+        if (xmem_cache_read8(XMEM_FAR(0, XMEM_PTR(0x4000 + i))) != (uint8_t)i
+            || xmem_cache_read8(XMEM_FAR(last, XMEM_PTR(0x4000 + i))) != (uint8_t)~i) {
+            p("Cached read failed at 0x%x\r\n", 0x4000 + i);
+            return -1;
+        }
+    }
+
+    xmem_cache_stats(&stats);
+    if (stats.misses != 2 * 64 / XMEM_CACHE_LINE_SIZE || stats.hits != 2 * 64 - stats.misses) {
+        p("Cache counted %lu hits and %lu misses\r\n", (unsigned long)stats.hits, (unsigned long)stats.misses);
+        return -1;
+    }
+
+    /* Writes stay in the cache until the line is written back. */
+    xmem_cache_write32(XMEM_FAR(0, XMEM_PTR(0x4000)), 0x44332211UL);
+    if (xmem_far_read8(XMEM_FAR(0, XMEM_PTR(0x4000))) != 0 || xmem_cache_read16(XMEM_FAR(0, XMEM_PTR(0x4001))) != 0x3322) {
+        p("Cached write went through\r\n");
+        return -1;
+    }
+
+    xmem_cache_flush();
+    if (xmem_far_read32(XMEM_FAR(0, XMEM_PTR(0x4000))) != 0x44332211UL) {
+        p("Cache flush lost a write\r\n");
+        return -1;
+    }
+
+    /* Far more than the cache holds, across the end of the banks. */
+    far = XMEM_FAR(0, XMEM_PTR(0xfe00));
+    for (uint16_t i = 0; i < 1024; i++, far = xmem_far_add(far, 2)) {
+        xmem_cache_write16(far, i * 3);
+    }
+
+    far = XMEM_FAR(0, XMEM_PTR(0xfe00));
+    for (uint16_t i = 0; i < 1024; i++, far = xmem_far_add(far, 2)) {
+        if (xmem_cache_read16(far) != (uint16_t)(i * 3)) {
+            p("Cached word %u got lost on eviction\r\n", i);
+            return -1;
+        }
+    }
+
+    xmem_cache_flush();
+    far = XMEM_FAR(0, XMEM_PTR(0xfe00));
+    for (uint16_t i = 0; i < 1024; i++, far = xmem_far_add(far, 2)) {
+        if (xmem_far_read16(far) != (uint16_t)(i * 3)) {
+            p("Word %u did not make it to memory\r\n", i);
+            return -1;
+        }
+    }
+
+    xmem_cache_stats(&stats);
+    if (stats.writebacks == 0) {
+        p("Cache never wrote back\r\n");
+        return -1;
+    }
+
+    xmem_switch_bank(0);
+
+    p("Cache test successful\r\n");
+
+    return 0;
+}
+
+int test_stats (void) {
+    struct xmem_stats before, after;
+    struct xmem_bank_stats bank;
+    uint8_t last = XMEM_BANKS - 1;
+    uint8_t *a, *b, *c;
+
+    p("Stats test starting...\r\n");
+
+    /* The far pointer and cache tests wrote over the bank heaps. */
+    xmem_init();
+
+    xmem_switch_bank(0);
+    xmem_get_stats(&before);
+
+    xmem_switch_bank(0);
+    xmem_switch_bank(last);
+    xmem_switch_bank(last);
+    xmem_switch_bank(0);
+    xmem_set_system_heap();
+    xmem_set_xmem_heap();
+
+    xmem_get_stats(&after);
+    if (after.switches - before.switches != 2 || after.redundant_switches - before.redundant_switches != 2
+        || after.heap_flips - before.heap_flips != (XMEM_NATIVE_MALLOC ? 0 : 2)) {
+        p("Stats counted %lu switches, %lu redundant and %lu heap flips\r\n",
+          (unsigned long)(after.switches - before.switches),
+          (unsigned long)(after.redundant_switches - before.redundant_switches),
+          (unsigned long)(after.heap_flips - before.heap_flips));
+        return -1;
+    }
+
+    a = xmem_malloc(last, 100);
+    b = xmem_malloc(last, 100);
+    c = xmem_malloc(last, 100);
+    xmem_free(last, b);
+    xmem_switch_bank(0);
+
+    xmem_get_bank_stats(last, &bank);
+    if (xmem_host_selected_bank() != 0 || bank.high_water < XMEM_ADDR(c) + 100
+        || bank.free_blocks == 0 || bank.free_bytes < 100) {
+        p("Bank stats: high water 0x%x, %u free blocks, %u free bytes\r\n",
+          bank.high_water, bank.free_blocks, bank.free_bytes);
+        return -1;
+    }
+
+    xmem_free(last, a);
+    xmem_free(last, c);
+    xmem_switch_bank(0);
+
+    p("Stats test successful\r\n");
+
+    return 0;
+}
+
+int test_handles (void) {
+    struct xmem_heap_info before, after;
+    xmem_handle_t handles[8];
+    uint8_t last = XMEM_BANKS - 1;
+    uint16_t moved, histogram, filler;
+
+    p("Handle test starting...\r\n");
+
+    for (uint8_t i = 0; i < 8; i++) {
+        handles[i] = xmem_halloc(last, 254);
+        if (handles[i] == 0) {
+            p("Could not allocate handle %i\r\n", i);
+            return -1;
+        }
+
+        memset(xmem_hlock(handles[i]), i, 254);
+        xmem_hunlock(handles[i]);
+    }
+
+    if (xmem_halloc(last, 10) != 0) {
+        p("Got more handles than XMEM_HANDLES\r\n");
+        return -1;
+    }
+
+    /* Fill the rest of the bank so the holes below are what counts, the
+       fillers are chained through their first two bytes. */
+    filler = 0;
+    for (uint16_t size = 4096; size >= 64; size /= 4) {
+        uint16_t *f;
+
+        while ((f = xmem_malloc(last, size)) != NULL) {
+            *f = filler;
+            filler = XMEM_ADDR(f);
+        }
+    }
+
+    /* Holes between the blocks that are left. */
+    for (uint8_t i = 0; i < 6; i += 2) {
+        xmem_hfree(handles[i]);
+        handles[i] = 0;
+    }
+
+    /* A locked block has to stay where it is. */
+    xmem_hlock(handles[7]);
+
+    xmem_heap_info(last, &before);
+    histogram = 0;
+    for (uint8_t i = 0; i < XMEM_HEAP_BUCKETS; i++) {
+        histogram += before.histogram[i];
+    }
+
+    if (before.free_blocks < 3 || histogram != before.free_blocks || before.largest < 254 || before.fragmentation == 0) {
+        p("Heap info: %u free blocks, largest %u, %u%% fragmented\r\n",
+          before.free_blocks, before.largest, before.fragmentation);
+        return -1;
+    }
+
+    /* 1, 3, 5 and 6 slide down over the three holes, which end up in one
+       piece under the locked block. */
+    moved = xmem_hcompact(last);
+    xmem_heap_info(last, &after);
+
+    if (moved != 4 || after.largest < 3 * 254 || after.fragmentation >= before.fragmentation) {
+        p("Compaction moved %u blocks, largest %u, fragmentation %u%% to %u%%\r\n",
+          moved, after.largest, before.fragmentation, after.fragmentation);
+        return -1;
+    }
+
+    if (xmem_hcompact(last) != 0) {
+        p("Compacting a compact bank moved blocks\r\n");
+        return -1;
+    }
+
+    for (uint8_t i = 0; i < 8; i++) {
+        uint8_t *data;
+
+        if (handles[i] == 0) {
+            continue;
+        }
+
+        data = xmem_hlock(handles[i]);
+        for (uint16_t j = 0; j < 254; j++) {
+            if (data[j] != i) {
+                p("Handle %i lost its data at byte %u\r\n", i, j);
+                return -1;
+            }
+        }
+        xmem_hunlock(handles[i]);
+        xmem_hfree(handles[i]);
+    }
+
+    xmem_switch_bank(last);
+    while (filler) {
+        uint16_t next = *(uint16_t *)XMEM_PTR(filler);
+
+        xmem_free(last, XMEM_PTR(filler));
+        filler = next;
+    }
+
+    xmem_switch_bank(0);
+
+    p("Handle test successful, %u blocks moved, fragmentation %u%% to %u%%\r\n",
+      moved, before.fragmentation, after.fragmentation);
+
+    return 0;
+}
+
+int test_low_heap (void) {
+    uint8_t last = XMEM_BANKS - 1;
+    uint8_t internal[300];
+    uint8_t *external = XMEM_PTR(0x6000);
+    uint16_t a, b, c, d;
+
+    p("Low heap test starting...\r\n");
+
+    a = xmem_low_alloc(0, 300);
+    b = xmem_low_alloc(0, 1000);
+    c = xmem_low_alloc(last, 8192);
+    if (a == 0 || b == 0 || c == 0 || b < a + 300 || xmem_low_alloc(last, 1) != 0) {
+        p("Low heap handed out 0x%x 0x%x 0x%x\r\n", a, b, c);
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < 300; i++) {
+        internal[i] = i;
+    }
+    xmem_low_write(0, a, 0, internal, 300);
+
+    /* Bulk data from the current bank goes through the copy buffer. */
+    xmem_switch_bank(last);
+    for (uint16_t i = 0; i < 1000; i++) {
+        external[i] = i * 5;
+    }
+    xmem_low_write(0, b, 0, external, 1000);
+    xmem_low_write(last, c, 8000, external, 192);
+    memset(external, 0, 1000);
+
+    xmem_low_read(0, b, 0, external, 1000);
+    for (uint16_t i = 0; i < 1000; i++) {
+        if (external[i] != (uint8_t)(i * 5)) {
+            p("Low block read back 0x%x at byte %u\r\n", external[i], i);
+            return -1;
+        }
+    }
+
+    if (xmem_host_selected_bank() != last) {
+        p("Low heap did not give the current bank back\r\n");
+        return -1;
+    }
+
+    memset(internal, 0, sizeof(internal));
+    xmem_low_read(0, a, 10, internal, 290);
+    for (uint16_t i = 0; i < 290; i++) {
+        if (internal[i] != (uint8_t)(i + 10)) {
+            p("Low block read back 0x%x at byte %u\r\n", internal[i], i + 10);
+            return -1;
+        }
+    }
+
+    /* It really is the lower 8KB of the chip. */
+    xmem_switch_bank(last);
+    xmem_unshadow_lower_memory();
+    if (((uint8_t *)XMEM_PTR(c))[8001] != 5) {
+        xmem_shadow_lower_memory();
+        p("Low block is not where it should be\r\n");
+        return -1;
+    }
+    xmem_shadow_lower_memory();
+
+    xmem_low_free(0, a);
+    d = xmem_low_alloc(0, 1000);
+    if (d == a || xmem_low_alloc(0, 300) != a) {
+        p("Low heap did not reuse the freed block\r\n");
+        return -1;
+    }
+
+    xmem_low_free(0, a);
+    xmem_low_free(0, b);
+    xmem_low_free(0, d);
+    xmem_low_free(last, c);
+    xmem_switch_bank(0);
+
+    p("Low heap test successful\r\n");
+
+    return 0;
+}
+
+/* Plays an interrupt handler that writes to the last bank. */
+static uint8_t _isr_seen;
+
+XMEM_ISR(TEST_vect) {
+    xmem_bank_select(XMEM_BANKS - 1);
+    _isr_seen = *(uint8_t *)XMEM_PTR(0x4000);
+    *(uint8_t *)XMEM_PTR(0x4001) = 0x5a;
+}
+
+int test_isr_bank (void) {
+    uint8_t port;
+
+    p("ISR bank test starting...\r\n");
+
+    xmem_switch_bank(XMEM_BANKS - 1);
+    *(uint8_t *)XMEM_PTR(0x4000) = 0xa5;
+    xmem_switch_bank(0);
+    *(uint8_t *)XMEM_PTR(0x4000) = 0x11;
+    port = PORTD;
+
+    TEST_vect();
+
+    if (_isr_seen != 0xa5) {
+        p("ISR did not see its bank, got 0x%x\r\n", _isr_seen);
+        return -1;
+    }
+
+    if (xmem_host_selected_bank() != 0 || PORTD != port || *(uint8_t *)XMEM_PTR(0x4000) != 0x11) {
+        p("ISR did not give back bank 0\r\n");
+        return -1;
+    }
+
+    /* Interrupted right after _current_bank changed but before the pins did. */
+    xmem_switch_bank(0);
+    _current_bank = XMEM_BANKS - 1;
+    TEST_vect();
+    if (xmem_host_selected_bank() != XMEM_BANKS - 1) {
+        p("ISR left the pins behind the bank\r\n");
+        return -1;
+    }
+
+    xmem_switch_bank(XMEM_BANKS - 1);
+    if (*(uint8_t *)XMEM_PTR(0x4001) != 0x5a) {
+        p("ISR write got lost\r\n");
+        return -1;
+    }
+
+    xmem_switch_bank(0);
+
+    p("ISR bank test successful\r\n");
+
+    return 0;
+}
+
+int test_switch_inline (void) {
+#if XMEM_TOTAL_MEMORY > 131072
+    uint8_t mask = XMEM_BANK_MASK(0, XMEM_BANK_BITS);
+    volatile uint8_t *port = &PORTL;
+    uint8_t shift = 0;
+#else
+    uint8_t mask = _BV(7);
+    volatile uint8_t *port = &PORTD;
+    uint8_t shift = 7;
+#endif
+#if XMEM_LAZY_HEAP || XMEM_NATIVE_MALLOC
+    char *heap_start = __malloc_heap_start;
+    char *heap_end = __malloc_heap_end;
+#endif
+
+    p("Inline bank switch test starting...\r\n");
+
+    xmem_switch_bank(0);
+
+    for (uint8_t bank = XMEM_BANKS; bank--; ) {
+        xmem_switch_bank_inline(bank);
+
+        if (_current_bank != bank || (*port & mask) != (uint8_t)(bank << shift)
+            || xmem_host_selected_bank() != bank) {
+            p("Inline switch to bank %i drove the port to 0x%x\r\n", bank, *port);
+            return -1;
+        }
+
+#if !XMEM_LAZY_HEAP && !XMEM_NATIVE_MALLOC
+        /* The heap follows the bank. */
+        if (__malloc_heap_start != xmem_get_current_bank_address_start()
+            || __malloc_heap_end != xmem_get_current_bank_address_end()) {
+            p("Inline switch to bank %i left the heap behind\r\n", bank);
+            return -1;
+        }
+#else
+        /* The heap stays where it was. */
+        if (__malloc_heap_start != heap_start || __malloc_heap_end != heap_end) {
+            p("Inline switch to bank %i moved the heap\r\n", bank);
+            return -1;
+        }
+#endif
+    }
+
+    /* Switching to the current bank does nothing, the pins are not driven again. */
+    *port ^= mask;
+    xmem_switch_bank_inline(0);
+    if ((*port & mask) == 0) {
+        p("Inline switch drove the pins of the current bank\r\n");
+        return -1;
+    }
+    *port ^= mask;
+
+    XMEM_SWITCH_BANK_CONST(XMEM_BANKS - 1);
+    if (_current_bank != XMEM_BANKS - 1 || (*port & mask) != (uint8_t)((XMEM_BANKS - 1) << shift)
+        || xmem_host_selected_bank() != XMEM_BANKS - 1) {
+        p("Constant switch to bank %i drove the port to 0x%x\r\n", XMEM_BANKS - 1, *port);
+        return -1;
+    }
+
+    XMEM_SWITCH_BANK_CONST(0);
+    if (_current_bank != 0 || (*port & mask) != 0 || xmem_host_selected_bank() != 0) {
+        p("Constant switch to bank 0 drove the port to 0x%x\r\n", *port);
+        return -1;
+    }
+
+#if !XMEM_LAZY_HEAP && !XMEM_NATIVE_MALLOC
+    if (__malloc_heap_start != xmem_get_current_bank_address_start()) {
+        p("Constant switch left the heap behind\r\n");
+        return -1;
+    }
+#endif
+
+    p("Inline bank switch test successful\r\n");
+
+    return 0;
+}
+
+#if XMEM_RUNTIME_CONFIG
+static uint16_t _select_calls = 0;
+
+static void test_select_bank (uint8_t bank) {
+    _select_calls++;
+    xmem_host_switch_bank(bank);
+}
+#endif
+
+int test_probe (void) {
+    static const uint32_t sizes[] = { 32768, 65536, XMEM_TOTAL_MEMORY };
+    uint8_t *ref = XMEM_PTR(0x2200);
+    uint8_t before[XMEM_BANKS];
+    uint32_t size;
+
+    p("Probe test starting...\r\n");
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        before[bank] = *ref;
+    }
+
+    for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        xmem_host_set_chip_size(sizes[i]);
+        size = xmem_probe();
+        if (size != sizes[i]) {
+            p("Probe found %lu bytes on a %lu byte chip\r\n", (unsigned long)size, (unsigned long)sizes[i]);
+            return -1;
+        }
+    }
+
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        if (*ref != before[bank]) {
+            p("Probe left 0x%x at 0x2200 on bank %i\r\n", *ref, bank);
+            return -1;
+        }
+    }
+
+#if XMEM_RUNTIME_CONFIG
+    {
+        struct xmem_config config = { 0, test_select_bank, 1, 1 };
+        uint8_t *ptr;
+
+        /* A 32KB board keeps one bank and gives PC7 back. */
+        xmem_host_set_chip_size(32768);
+        xmem_init_ex(&config);
+
+        if (xmem_bank_count() != 1 || xmem_far_size() != 32768 - 0x2200
+            || (XMCRB & 7) != 1 || _select_calls == 0) {
+            p("32KB board set up with %i banks, %lu bytes, XMCRB 0x%x\r\n", xmem_bank_count(),
+              (unsigned long)xmem_far_size(), XMCRB);
+            return -1;
+        }
+
+        if (xmem_get_current_bank_address_end() != XMEM_PTR(0x7fff)
+            || xmem_malloc(1, 16) != NULL || xmem_malloc(0, 0x6000) != NULL) {
+            p("32KB board has room past its end\r\n");
+            return -1;
+        }
+
+#if XMEM_HEAP_SECTOR == XMEM_SECTOR_UPPER && XMEM_SECTOR_LIMIT
+        /* The upper sector starts past the end of the memory. */
+        ptr = xmem_malloc(0, 16);
+        if (ptr != NULL) {
+            p("32KB board has a heap above its end\r\n");
+            return -1;
+        }
+#else
+        ptr = xmem_malloc(0, 1000);
+        if (ptr == NULL) {
+            p("32KB board can't allocate\r\n");
+            return -1;
+        }
+        xmem_free(0, ptr);
+#endif
+
+        /* The callback drives the banks of a bigger board. */
+        xmem_host_set_chip_size(131072);
+        xmem_init_ex(&config);
+        _select_calls = 0;
+        xmem_switch_bank(1);
+
+        if (xmem_bank_count() != 2 || _select_calls != 1 || xmem_host_selected_bank() != 1
+            || (XMCRA & 0x0f) != ((1 << SRW10) | (1 << SRW00))) {
+            p("128KB board set up with %i banks, %i bank selects, XMCRA 0x%x\r\n", xmem_bank_count(),
+              _select_calls, XMCRA);
+            return -1;
+        }
+
+        xmem_host_set_chip_size(XMEM_TOTAL_MEMORY);
+        xmem_init();
+    }
+#endif
+
+    p("Probe test successful\r\n");
+
+    return 0;
+}
+
+#if XMEM_COMMON_END
+int test_common (void) {
+    uint8_t last = XMEM_BANKS - 1;
+    uint8_t *shared = XMEM_PTR(0x3000);
+    uint8_t *banked = XMEM_PTR(XMEM_BANKED_START);
+    struct xmem_heap_info info;
+    struct xmem_stats stats;
+    uint32_t switches;
+    uint8_t *a, *b, *c;
+
+    p("Common region test starting...\r\n");
+
+    xmem_switch_bank(0);
+    *shared = 0x42;
+    *banked = 0x10;
+    xmem_switch_bank(last);
+    *banked = 0x20;
+
+    if (*shared != 0x42) {
+        p("Bank %i does not see the common region\r\n", last);
+        return -1;
+    }
+
+    *shared = 0x43;
+    xmem_switch_bank(0);
+    if (*shared != 0x43 || *banked != 0x10) {
+        p("Bank 0 sees 0x%x in the common region and 0x%x above it\r\n", *shared, *banked);
+        return -1;
+    }
+
+    /* Common allocations never switch banks. */
+    xmem_switch_bank(last);
+    xmem_get_stats(&stats);
+    switches = stats.switches;
+    a = xmem_malloc(XMEM_COMMON, 1000);
+    b = xmem_malloc(XMEM_COMMON, 500);
+    c = xmem_malloc(last, 1000);
+    xmem_get_stats(&stats);
+
+    if (a == NULL || b == NULL || c == NULL || XMEM_ADDR(a) > XMEM_COMMON_END || XMEM_ADDR(b) > XMEM_COMMON_END
+        || XMEM_ADDR(c) < XMEM_BANKED_START || stats.switches != switches || _current_bank != last) {
+        p("Common allocations at 0x%x 0x%x, bank allocation at 0x%x, %lu switches\r\n",
+          XMEM_ADDR(a), XMEM_ADDR(b), XMEM_ADDR(c), (unsigned long)(stats.switches - switches));
+        return -1;
+    }
+
+    if (xmem_malloc(XMEM_COMMON, XMEM_COMMON_END - 0x2200) != NULL) {
+        p("Common region handed out more than it has\r\n");
+        return -1;
+    }
+
+    memset(a, 0x5a, 1000);
+    xmem_switch_bank(0);
+    if (a[999] != 0x5a) {
+        p("Common allocation lost its data on bank 0\r\n");
+        return -1;
+    }
+
+    xmem_heap_info(XMEM_COMMON, &info);
+    if (info.free_bytes + info.unused > XMEM_COMMON_END + 1 - 0x2200 - 1500) {
+        p("Common heap has %u free bytes after 1500 were taken\r\n", info.free_bytes + info.unused);
+        return -1;
+    }
+
+    xmem_free(XMEM_COMMON, a);
+    xmem_free(XMEM_COMMON, b);
+    xmem_free(last, c);
+
+    if (xmem_far_size() != (uint32_t)XMEM_BANKS * (0x10000 - XMEM_BANKED_START)) {
+        p("Far space is %lu bytes\r\n", (unsigned long)xmem_far_size());
+        return -1;
+    }
+
+    p("Common region test successful\r\n");
+
+    return 0;
+}
+#endif
+
+int test_vm (void) {
+    uint32_t base = xmem_far_size() / XMEM_BANKS - 8 * XMEM_VM_PAGE_SIZE;
+    uint32_t span = 16 * XMEM_VM_PAGE_SIZE;
+    static uint8_t saved[16 * XMEM_VM_PAGE_SIZE];
+    struct xmem_vm_stats stats;
+    uint16_t lfsr = 1;
+    uint8_t *ptr;
+
+    p("Paging test starting...\r\n");
+
+    /* The span covers the heaps at the end of bank 0 and the start of bank 1. */
+    for (uint32_t i = 0; i < span; i++) {
+        saved[i] = xmem_far_read8(xmem_far_add(XMEM_FAR_START, base + i));
+    }
+
+    xmem_vm_invalidate();
+    xmem_vm_stats(&stats);
+
+    /* Sixteen pages through four frames, across the end of bank 0. */
+    for (uint32_t i = 0; i < span; i++) {
+        lfsr = XMEM_LFSR(lfsr);
+        *(uint8_t *)xmem_vm_ptr(base + i, 1) = (uint8_t)lfsr;
+    }
+    xmem_vm_flush();
+    xmem_vm_stats(&stats);
+
+    if (stats.faults != 16 || stats.writebacks != 16 || stats.hits != span - 16) {
+        p("Paging took %lu faults, %lu writebacks, %lu hits\r\n", (unsigned long)stats.faults,
+          (unsigned long)stats.writebacks, (unsigned long)stats.hits);
+        return -1;
+    }
+
+    lfsr = 1;
+    for (uint32_t i = 0; i < span; i++) {
+        lfsr = XMEM_LFSR(lfsr);
+        if (xmem_far_read8(xmem_far_add(XMEM_FAR_START, base + i)) != (uint8_t)lfsr
+            || *(uint8_t *)xmem_vm_ptr(base + i, 0) != (uint8_t)lfsr) {
+            p("Paged byte %lu did not make it to its bank\r\n", (unsigned long)i);
+            return -1;
+        }
+    }
+
+    /* Pages that were only read are not written back. */
+    xmem_vm_flush();
+    xmem_vm_stats(&stats);
+    if (stats.writebacks != 0) {
+        p("Paging wrote back %lu clean pages\r\n", (unsigned long)stats.writebacks);
+        return -1;
+    }
+
+    /* Page 0 was used last, page 1 is the one to go. */
+    for (uint8_t i = 0; i < 4; i++) {
+        xmem_vm_ptr(i * XMEM_VM_PAGE_SIZE, 0);
+    }
+    xmem_vm_ptr(0, 0);
+    xmem_vm_ptr(4 * XMEM_VM_PAGE_SIZE, 0);
+    xmem_vm_stats(&stats);
+    xmem_vm_ptr(0, 0);
+    xmem_vm_ptr(1 * XMEM_VM_PAGE_SIZE, 0);
+    xmem_vm_stats(&stats);
+    if (stats.hits != 1 || stats.faults != 1) {
+        p("LRU kept the wrong page, %lu hits %lu faults\r\n", (unsigned long)stats.hits, (unsigned long)stats.faults);
+        return -1;
+    }
+
+    ptr = xmem_vm_ptr(xmem_far_size() - 1, 0);
+    if (ptr == NULL || xmem_vm_ptr(xmem_far_size(), 0) != NULL) {
+        p("Paging does not end with the far space\r\n");
+        return -1;
+    }
+
+    xmem_vm_invalidate();
+
+    for (uint32_t i = 0; i < span; i++) {
+        xmem_far_write8(xmem_far_add(XMEM_FAR_START, base + i), saved[i]);
+    }
+
+#if XMEM_RUNTIME_CONFIG
+    {
+        /* The last page runs 64 bytes past the end of the memory. */
+        struct xmem_config config = { XMEM_TOTAL_MEMORY - 64, NULL, 0, 0 };
+        uint32_t last = xmem_far_size() - 64 - XMEM_VM_PAGE_SIZE / 2;
+
+        xmem_init_ex(&config);
+        xmem_switch_bank(XMEM_BANKS - 1);
+        *(uint8_t *)XMEM_PTR(0xffc0) = 0x5a;
+
+        for (uint16_t i = 0; i < XMEM_VM_PAGE_SIZE; i++) {
+            *(uint8_t *)xmem_vm_ptr(last + i, 1) = 0xa5;
+        }
+        xmem_vm_flush();
+        xmem_vm_invalidate();
+
+        xmem_switch_bank(0);
+        xmem_switch_bank(XMEM_BANKS - 1);
+        if (*(uint8_t *)XMEM_PTR(0xffbf) != 0xa5 || *(uint8_t *)XMEM_PTR(0xffc0) != 0x5a) {
+            p("Paging wrote past the end of the memory\r\n");
+            return -1;
+        }
+
+        xmem_init();
+    }
+#endif
+
+    p("Paging test successful\r\n");
+
+    return 0;
+}
+
+/* Plays a sensor interrupt pushing 6 byte records into _ring. */
+static struct xmem_ring _ring;
+static uint8_t _ring_pushed;
+
+XMEM_ISR(RING_vect) {
+    uint8_t record[6];
+
+    for (uint8_t i = 0; i < sizeof(record); i++) {
+        record[i] = _ring_pushed + i;
+    }
+    if (xmem_ring_push(&_ring, record, sizeof(record))) {
+        _ring_pushed++;
+    }
+}
+
+/* Pop up to count records and check they come in order after *popped. */
+static int test_ring_drain (uint8_t count, uint8_t *popped) {
+    uint8_t buf[60];
+    uint16_t len = xmem_ring_pop(&_ring, buf, count * 6);
+
+    if (len % 6) {
+        p("Ring popped %u bytes, not whole records\r\n", len);
+        return -1;
+    }
+
+    for (uint16_t i = 0; i < len; i++) {
+        if (buf[i] != (uint8_t)(*popped + i / 6 + i % 6)) {
+            p("Ring byte %u of record %u is 0x%x\r\n", i % 6, *popped + i / 6, buf[i]);
+            return -1;
+        }
+    }
+    *popped += len / 6;
+
+    return 0;
+}
+
+int test_ring (void) {
+    uint8_t last = XMEM_BANKS - 1;
+    uint8_t popped = 0;
+    struct xmem_stats before, after;
+    uint8_t xmcrb;
+
+    p("Ring test starting...\r\n");
+
+    if (xmem_ring_init(&_ring, last, 100) || !xmem_ring_init(&_ring, last, 256)) {
+        p("Ring sizes are not checked\r\n");
+        return -1;
+    }
+
+    /* 42 records fill 252 bytes, the rest don't fit. */
+    xmem_switch_bank(0);
+    _ring_pushed = 0;
+    xmem_get_stats(&before);
+    for (uint8_t i = 0; i < 50; i++) {
+        RING_vect();
+    }
+    xmem_get_stats(&after);
+
+    if (_ring_pushed != 42 || xmem_ring_count(&_ring) != 252 || xmem_ring_space(&_ring) != 4) {
+        p("Ring took %u records, holds %u bytes\r\n", _ring_pushed, xmem_ring_count(&_ring));
+        return -1;
+    }
+    if (_current_bank != 0 || xmem_host_selected_bank() != 0 || after.switches != before.switches) {
+        p("Ring pushes left bank %u selected\r\n", xmem_host_selected_bank());
+        return -1;
+    }
+
+    /* Drain and refill so the ring wraps many times. */
+    while (popped < 200) {
+        if (test_ring_drain(10, &popped)) {
+            return -1;
+        }
+        for (uint8_t i = 0; i < 7 && _ring_pushed < 210; i++) {
+            RING_vect();
+        }
+    }
+
+    /* Interrupted right after _current_bank changed to the ring's bank but
+       before the pins did, the push still has to land in the ring's bank. */
+    xmem_switch_bank(0);
+    _current_bank = last;
+    RING_vect();
+    if (xmem_host_selected_bank() != last) {
+        p("Ring push left the pins on bank %u\r\n", xmem_host_selected_bank());
+        return -1;
+    }
+    xmem_bank_select(last);
+    xmem_switch_bank(0);
+    while (popped != _ring_pushed) {
+        if (test_ring_drain(10, &popped)) {
+            return -1;
+        }
+    }
+
+    /* An interrupt while the lower memory is unshadowed. */
+    xmem_unshadow_lower_memory();
+    xmcrb = XMCRB;
+    RING_vect();
+    if (XMCRB != xmcrb) {
+        p("Ring push left XMCRB at 0x%x\r\n", XMCRB);
+        xmem_shadow_lower_memory();
+        return -1;
+    }
+    xmem_shadow_lower_memory();
+
+    while (popped != _ring_pushed) {
+        if (test_ring_drain(10, &popped)) {
+            return -1;
+        }
+    }
+    xmem_ring_release(&_ring);
+
+#if XMEM_LOW_HEAP
+    /* In the lower 8KB, the bank 0 memory at the same address stays as it was. */
+    if (!xmem_ring_init_low(&_ring, last, 128)) {
+        p("No low ring\r\n");
+        return -1;
+    }
+    xmem_switch_bank(0);
+    *(uint8_t *)XMEM_PTR(_ring.data) = 0x3c;
+    for (uint8_t i = 0; i < 10; i++) {
+        RING_vect();
+    }
+    if (*(uint8_t *)XMEM_PTR(_ring.data) != 0x3c || (XMCRB & 7) != 0) {
+        p("Low ring push reached bank 0\r\n");
+        return -1;
+    }
+    while (popped != _ring_pushed) {
+        if (test_ring_drain(10, &popped)) {
+            return -1;
+        }
+    }
+    xmem_ring_release(&_ring);
+#endif
+
+#if XMEM_COMMON_END
+    if (!xmem_ring_init(&_ring, XMEM_COMMON, 64)) {
+        p("No common ring\r\n");
+        return -1;
+    }
+    xmem_switch_bank(last);
+    RING_vect();
+    if (test_ring_drain(1, &popped) || popped != _ring_pushed || xmem_host_selected_bank() != last) {
+        return -1;
+    }
+    xmem_ring_release(&_ring);
+#endif
+
+    xmem_switch_bank(0);
+
+    p("Ring test successful\r\n");
+
+    return 0;
+}
+
+/* Plays an ADC interrupt writing 100 byte bursts into _pingpong. */
+static struct xmem_pingpong _pingpong;
+static uint16_t _burst_written;
+static uint32_t _burst_bytes;
+
+XMEM_ISR(ADC_vect) {
+    uint8_t burst[100];
+
+    for (uint8_t i = 0; i < sizeof(burst); i++) {
+        burst[i] = (uint8_t)(_burst_bytes + i) ^ 0x5a;
+    }
+    _burst_written = xmem_pingpong_write(&_pingpong, burst, sizeof(burst));
+    _burst_bytes += _burst_written;
+}
+
+/* Check a consumer buffer holds the burst bytes from *checked on. */
+static int test_pingpong_check (const uint8_t *buf, uint16_t len, uint32_t *checked) {
+    for (uint16_t i = 0; i < len; i++) {
+        if (buf[i] != ((uint8_t)(*checked + i) ^ 0x5a)) {
+            p("Double buffer byte %lu is 0x%x\r\n", (unsigned long)(*checked + i), buf[i]);
+            return -1;
+        }
+    }
+    *checked += len;
+
+    return 0;
+}
+
+int test_pingpong (void) {
+    uint8_t last = XMEM_BANKS - 1;
+    struct xmem_stats before, after;
+    uint32_t checked = 0;
+    uint16_t len;
+    uint8_t *buf;
+
+    p("Double buffer test starting...\r\n");
+
+    /* As big as both banks allow. */
+    if (!xmem_pingpong_init(&_pingpong, 0, last, 0) || _pingpong.size < 4096
+        || _pingpong.bank[0] != 0 || _pingpong.bank[1] != last) {
+        p("Double buffers got %u bytes\r\n", _pingpong.size);
+        return -1;
+    }
+    xmem_pingpong_free(&_pingpong);
+
+    if (!xmem_pingpong_init(&_pingpong, 0, last, 512)) {
+        p("No double buffers\r\n");
+        return -1;
+    }
+
+    xmem_switch_bank(0);
+    _burst_bytes = 0;
+    if (xmem_pingpong_acquire(&_pingpong, &len) != NULL) {
+        p("Double buffer handed over before a swap\r\n");
+        return -1;
+    }
+
+    /* The first buffer fills up and goes to the consumer on its own. */
+    for (uint8_t i = 0; i < 6; i++) {
+        ADC_vect();
+    }
+    buf = xmem_pingpong_acquire(&_pingpong, &len);
+    if (buf == NULL || len != 512 || _current_bank != 0 || test_pingpong_check(buf, len, &checked)) {
+        p("Double buffer handed over %u bytes\r\n", buf ? len : 0);
+        return -1;
+    }
+
+    /* The producer fills the other bank while the consumer holds bank 0. */
+    xmem_get_stats(&before);
+    for (uint8_t i = 0; i < 5; i++) {
+        ADC_vect();
+    }
+    xmem_get_stats(&after);
+    if (_burst_written != 24 || _burst_bytes != 1024 || xmem_host_selected_bank() != 0
+        || after.switches != before.switches) {
+        p("Producer wrote %u bytes, left bank %u\r\n", _burst_written, xmem_host_selected_bank());
+        return -1;
+    }
+    if (xmem_pingpong_swap(&_pingpong)) {
+        p("Double buffer swapped while the consumer had one\r\n");
+        return -1;
+    }
+
+    xmem_pingpong_release(&_pingpong);
+    if (!xmem_pingpong_swap(&_pingpong) || xmem_pingpong_swap(&_pingpong)) {
+        p("Double buffer did not swap once\r\n");
+        return -1;
+    }
+
+    buf = xmem_pingpong_acquire(&_pingpong, &len);
+    if (buf == NULL || len != 512 || _current_bank != last || test_pingpong_check(buf, len, &checked)) {
+        p("Second double buffer handed over %u bytes\r\n", buf ? len : 0);
+        return -1;
+    }
+
+    /* The consumer is half way through switching to the producer's bank 0,
+       _current_bank already says 0 and the pins are still on the last bank. The
+       bytes repeat every 256, so clear what the first buffer held before. */
+    xmem_fill(0, XMEM_PTR(_pingpong.data[0]), XMEM_PTR(_pingpong.data[0] + 99), 0);
+    xmem_switch_bank(last);
+    _current_bank = 0;
+    ADC_vect();
+    xmem_bank_select(0);
+    xmem_pingpong_release(&_pingpong);
+
+    if (!xmem_pingpong_swap(&_pingpong)) {
+        p("Double buffer did not swap a partial buffer\r\n");
+        return -1;
+    }
+    buf = xmem_pingpong_acquire(&_pingpong, &len);
+    if (buf == NULL || len != 100 || test_pingpong_check(buf, len, &checked)) {
+        p("Burst written during a bank switch went astray\r\n");
+        return -1;
+    }
+    xmem_pingpong_release(&_pingpong);
+
+    xmem_pingpong_free(&_pingpong);
+    xmem_switch_bank(0);
+
+    p("Double buffer test successful\r\n");
+
+    return 0;
+}
+
+int test_stream (void) {
+    static uint8_t saved[3000];
+    uint32_t base = xmem_far_size() / XMEM_BANKS - 1000;
+    xmem_far_t far = xmem_far_add(XMEM_FAR_START, base);
+    struct xmem_stats before, after;
+    struct xmem_stream stream;
+    uint8_t buf[128];
+    uint16_t lfsr = 1;
+    uint16_t n;
+
+    p("Stream test starting...\r\n");
+
+    /* The range covers the heaps at the end of bank 0 and the start of bank 1. */
+    xmem_stream_open(&stream, far, sizeof(saved));
+    if (xmem_stream_read(&stream, saved, sizeof(saved)) != sizeof(saved)) {
+        p("Stream read came up short\r\n");
+        return -1;
+    }
+
+    /* Odd chunks so they straddle the bank end, one switch into bank 1. */
+    xmem_switch_bank(0);
+    xmem_get_stats(&before);
+    xmem_stream_open(&stream, far, sizeof(saved));
+    do {
+        for (uint8_t i = 0; i < 100; i++) {
+            lfsr = XMEM_LFSR(lfsr);
+            buf[i] = lfsr;
+        }
+        n = xmem_stream_write(&stream, buf, 100);
+    } while (n == 100);
+    xmem_get_stats(&after);
+
+    if (n != sizeof(saved) % 100 || stream.left != 0 || after.switches - before.switches != 1) {
+        p("Stream wrote a last chunk of %u bytes with %lu switches\r\n", n,
+          (unsigned long)(after.switches - before.switches));
+        return -1;
+    }
+
+    lfsr = 1;
+    for (uint16_t i = 0; i < sizeof(saved); i++) {
+        lfsr = XMEM_LFSR(lfsr);
+        if (xmem_far_read8(xmem_far_add(far, i)) != (uint8_t)lfsr) {
+            p("Stream byte %u did not land\r\n", i);
+            return -1;
+        }
+    }
+
+    xmem_stream_open(&stream, far, sizeof(saved));
+    lfsr = 1;
+    while ((n = xmem_stream_read(&stream, buf, sizeof(buf))) != 0) {
+        for (uint16_t i = 0; i < n; i++) {
+            lfsr = XMEM_LFSR(lfsr);
+            if (buf[i] != (uint8_t)lfsr) {
+                p("Stream read back 0x%x\r\n", buf[i]);
+                return -1;
+            }
+        }
+    }
+
+    xmem_stream_open(&stream, far, sizeof(saved));
+    xmem_stream_write(&stream, saved, sizeof(saved));
+
+    /* Ranges end with the far space. */
+    xmem_stream_open(&stream, xmem_far_add(XMEM_FAR_START, xmem_far_size() - 10), 100);
+    if (xmem_stream_read(&stream, buf, sizeof(buf)) != 10) {
+        p("Stream ran past the far space\r\n");
+        return -1;
+    }
+    xmem_stream_open(&stream, xmem_far_add(XMEM_FAR_START, xmem_far_size()), 100);
+    if (xmem_stream_read(&stream, buf, sizeof(buf)) != 0) {
+        p("Stream opened past the far space\r\n");
+        return -1;
+    }
+    if (XMEM_BANKS > 1) {
+        /* Below XMEM_BANKED_START is not part of a bank's far space. */
+        xmem_stream_open(&stream, XMEM_FAR(1, XMEM_PTR(XMEM_BANKED_START - 0x100)), 100);
+        if (stream.left != 0 || xmem_stream_read(&stream, buf, sizeof(buf)) != 0) {
+            p("Stream opened below the banked window\r\n");
+            return -1;
+        }
+    }
+
+    xmem_switch_bank(0);
+
+    p("Stream test successful\r\n");
+
+    return 0;
+}
+
+int test_fill (void) {
+    uint8_t *low, *bad;
+
+    p("Fill test starting...\r\n");
+
+    /* Every bank its own seed, so aliasing banks fail. */
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        xmem_fill_pattern(bank, xmem_get_current_bank_address_start(), xmem_get_current_bank_address_end(), bank + 1);
+    }
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        bad = xmem_verify_pattern(bank, xmem_get_current_bank_address_start(), xmem_get_current_bank_address_end(),
+                                  bank + 1);
+        if (bad != NULL) {
+            p("Pattern check failed on bank %i at 0x%x\r\n", bank, XMEM_ADDR(bad));
+            return -1;
+        }
+    }
+
+    /* One bad byte in a full block and one in the tail. */
+    xmem_switch_bank(XMEM_BANKS - 1);
+    bad = (uint8_t *)xmem_get_current_bank_address_start() + 1003;
+    *bad ^= 0x10;
+    if (xmem_verify_pattern(XMEM_BANKS - 1, xmem_get_current_bank_address_start(), bad + 100, XMEM_BANKS) != bad
+        || xmem_verify_pattern(XMEM_BANKS - 1, xmem_get_current_bank_address_start(), bad, XMEM_BANKS) != bad) {
+        p("Pattern check missed a bad byte\r\n");
+        return -1;
+    }
+
+    /* Odd bounds, the bytes around them stay 0. */
+    xmem_fill(0, XMEM_PTR(0x3000), XMEM_PTR(0x3101), 0);
+    xmem_fill(0, XMEM_PTR(0x3001), XMEM_PTR(0x3100), 0xa5);
+    for (uint16_t addr = 0x3000; addr <= 0x3101; addr++) {
+        uint8_t expected = addr == 0x3000 || addr == 0x3101 ? 0 : 0xa5;
+
+        if (*(uint8_t *)XMEM_PTR(addr) != expected) {
+            p("Fill left 0x%x at 0x%x\r\n", *(uint8_t *)XMEM_PTR(addr), addr);
+            return -1;
+        }
+    }
+
+    /* There is no bank XMEM_BANKS, the selected one is left alone. */
+    xmem_fill(XMEM_BANKS, XMEM_PTR(0x3001), XMEM_PTR(0x3100), 0x11);
+    xmem_fill_pattern(XMEM_BANKS, XMEM_PTR(0x3001), XMEM_PTR(0x3100), 1);
+    if (_current_bank != 0 || *(uint8_t *)XMEM_PTR(0x3001) != 0xa5 || *(uint8_t *)XMEM_PTR(0x3100) != 0xa5
+        || xmem_verify_pattern(XMEM_BANKS, XMEM_PTR(0x3001), XMEM_PTR(0x3100), 1) != XMEM_PTR(0x3001)) {
+        p("Fill went to bank %i for a bank that doesn't exist\r\n", _current_bank);
+        return -1;
+    }
+
+    low = xmem_unshadow_lower_memory();
+    xmem_fill_pattern(0, low, low + 8191, 77);
+    bad = xmem_verify_pattern(0, low, low + 8191, 77);
+    xmem_shadow_lower_memory();
+    if (bad != NULL) {
+        p("Pattern check failed in the lower memory\r\n");
+        return -1;
+    }
+
+    /* The heaps went with the patterns, start over. */
+    xmem_init();
+
+#if XMEM_CLEAR_ON_INIT
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        xmem_switch_bank(bank);
+        for (uint32_t addr = 0x2200; addr <= XMEM_ADDR(xmem_get_current_bank_address_end()); addr++) {
+            if (*(uint8_t *)XMEM_PTR(addr)) {
+                p("xmem_init left 0x%x at 0x%lx of bank %i\r\n", *(uint8_t *)XMEM_PTR(addr), (unsigned long)addr, bank);
+                return -1;
+            }
+        }
+    }
+#endif
+
+    xmem_switch_bank(0);
+
+    p("Fill test successful\r\n");
+
+    return 0;
+}
+
+int test_memtest (void) {
+    uint8_t last = XMEM_BANKS - 1;
+    struct xmem_memtest status;
+    uint8_t saved[XMEM_COPY_BUFFER];
+    uint32_t steps = 0;
+    uint8_t *block, *low;
+#if XMEM_LOW_HEAP
+    uint16_t low_block = xmem_low_alloc(last, 100);
+#endif
+
+    p("Background memory test starting...\r\n");
+
+    block = xmem_malloc(last, 100);
+    for (uint8_t i = 0; i < 100; i++) {
+        block[i] = i;
+    }
+#if XMEM_LOW_HEAP
+    xmem_low_write(last, low_block, 0, block, 100);
+#endif
+
+    /* One full sweep from bank 0, memory in use keeps its contents. */
+    xmem_switch_bank(0);
+    xmem_memtest_reset();
+    do {
+        if (!xmem_memtest_step()) {
+            p("Background test failed a good chunk\r\n");
+            return -1;
+        }
+        steps++;
+        xmem_memtest_status(&status);
+    } while (status.sweeps == 0);
+
+    if (status.tested != 0 || status.failures != 0 || _current_bank != 0 || xmem_host_selected_bank() != 0
+        || status.size != xmem_far_size() + (XMEM_COMMON_END ? 0x3fff + 1 - 0x2200 : 0) + XMEM_BANKS * 8192UL
+        || steps < status.size / XMEM_COPY_BUFFER || steps > status.size / XMEM_COPY_BUFFER + XMEM_BANKS + 1) {
+        p("Background sweep of %lu bytes took %lu steps\r\n", (unsigned long)status.size, (unsigned long)steps);
+        return -1;
+    }
+
+    xmem_switch_bank(last);
+    for (uint8_t i = 0; i < 100; i++) {
+        if (block[i] != i) {
+            p("Background test changed byte %u of a block\r\n", i);
+            return -1;
+        }
+    }
+    xmem_free(last, block);
+
+#if XMEM_LOW_HEAP
+    {
+        uint8_t back[100];
+
+        xmem_low_read(last, low_block, 0, back, 100);
+        for (uint8_t i = 0; i < 100; i++) {
+            if (back[i] != i) {
+                p("Background test changed byte %u of a low block\r\n", i);
+                return -1;
+            }
+        }
+        xmem_low_free(last, low_block);
+    }
+#endif
+
+    /* A chip that's too slow for the wait states, the first chunk is at 0x2200 of bank 0. */
+    xmem_switch_bank(0);
+    memcpy(saved, XMEM_PTR(0x2200), sizeof(saved));
+    xmem_host_set_chip_wait_states(3);
+    if (xmem_memtest_step()) {
+        xmem_host_set_chip_wait_states(0);
+        p("Background test passed a slow chip\r\n");
+        return -1;
+    }
+    xmem_host_set_chip_wait_states(0);
+    memcpy(XMEM_PTR(0x2200), saved, sizeof(saved));
+
+    xmem_memtest_status(&status);
+    if (status.failures != 1 || XMEM_FAR_ADDR(status.first_failure) < 0x2200
+        || XMEM_FAR_ADDR(status.first_failure) >= 0x2200 + XMEM_COPY_BUFFER) {
+        p("Background test reported %u failures\r\n", status.failures);
+        return -1;
+    }
+
+    /* The same in the lower 8KB of bank 0, reported by its address in the chip. */
+    xmem_memtest_reset();
+    do {
+        xmem_memtest_step();
+        xmem_memtest_status(&status);
+    } while (status.tested < status.size - XMEM_BANKS * 8192UL);
+
+    low = xmem_unshadow_lower_memory();
+    memcpy(saved, low, sizeof(saved));
+    xmem_shadow_lower_memory();
+    xmem_host_set_chip_wait_states(3);
+    if (xmem_memtest_step()) {
+        xmem_host_set_chip_wait_states(0);
+        p("Background test passed a slow chip in the lower memory\r\n");
+        return -1;
+    }
+    xmem_host_set_chip_wait_states(0);
+    low = xmem_unshadow_lower_memory();
+    memcpy(low, saved, sizeof(saved));
+    xmem_shadow_lower_memory();
+
+    xmem_memtest_status(&status);
+    if (status.failures != 1 || XMEM_FAR_BANK(status.first_failure) != 0
+        || XMEM_FAR_ADDR(status.first_failure) >= XMEM_COPY_BUFFER) {
+        p("Background test reported the lower memory failure at 0x%lx\r\n", (unsigned long)status.first_failure);
+        return -1;
+    }
+
+    xmem_memtest_reset();
+
+    p("Background memory test successful\r\n");
+
+    return 0;
+}
+
+#if XMEM_LAZY_BANK_INIT
+extern uint8_t _bank_ready[];
+
+static uint8_t test_bank_ready (uint8_t bank) {
+    return _bank_ready[bank >> 3] & _BV(bank & 7);
+}
+
+int test_lazy_banks (void) {
+    uint8_t last = XMEM_BANKS - 1;
+    uint16_t end = XMEM_TOTAL_MEMORY % 65536 ? XMEM_TOTAL_MEMORY % 65536 - 1 : 0xffff;
+    uint8_t *ptr;
+
+    p("Lazy bank test starting...\r\n");
+
+#if XMEM_RUNTIME_CONFIG
+    {
+        /* A last bank 16KB short. */
+        struct xmem_config config = { XMEM_TOTAL_MEMORY - 0x4000, NULL, 0, 0 };
+
+        xmem_init_ex(&config);
+        end = 0xbfff;
+    }
+#else
+    xmem_init();
+#endif
+
+    /* Only the bank malloc() was handed is set up, and only without the native allocator. */
+    for (uint8_t bank = 0; bank < XMEM_BANKS; bank++) {
+        if (!test_bank_ready(bank) != !(bank == 0 && !XMEM_NATIVE_MALLOC)) {
+            p("xmem_init set up bank %i\r\n", bank);
+            return -1;
+        }
+    }
+
+    /* The first allocation on the last bank sets it up, ending where the memory does. */
+    ptr = xmem_malloc(last, 0x100);
+    if (ptr == NULL || !test_bank_ready(last) || XMEM_ADDR(ptr) + 0x100 - 1 > end
+        || xmem_malloc(last, end - XMEM_ADDR(ptr) + 0x400) != NULL) {
+        p("Bank %i was set up past 0x%x\r\n", last, end);
+        return -1;
+    }
+
+    xmem_switch_bank(last);
+    if (xmem_get_current_bank_address_end() != XMEM_PTR(end)) {
+        p("Bank %i ends at 0x%x instead of 0x%x\r\n", last, XMEM_ADDR(xmem_get_current_bank_address_end()), end);
+        return -1;
+    }
+
+    xmem_free(last, ptr);
+    xmem_init();
+
+    p("Lazy bank test successful\r\n");
+
+    return 0;
+}
+#endif
+
+#if XMEM_RUNTIME_CONFIG && XMEM_HEAP_SECTOR == XMEM_SECTOR_UPPER && XMEM_SECTOR_LIMIT
+int test_short_upper_bank (void) {
+    /* The last bank ends 16KB in, below the upper sector. */
+    struct xmem_config config = { 65536 + 0x4000, NULL, 0, 0 };
+    struct xmem_heap_info info;
+    uint8_t *ptr;
+
+    p("Short upper bank test starting...\r\n");
+
+    xmem_init_ex(&config);
+    xmem_switch_bank(1);
+
+    if (xmem_bank_count() != 2 || XMEM_ADDR(xmem_get_current_bank_address_end()) != 0x3fff
+        || XMEM_ADDR(xmem_get_current_bank_address_start()) != 0x4000) {
+        p("Short bank heap runs from 0x%x to 0x%x\r\n", XMEM_ADDR(xmem_get_current_bank_address_start()),
+          XMEM_ADDR(xmem_get_current_bank_address_end()));
+        return -1;
+    }
+
+    xmem_heap_info(1, &info);
+    if (xmem_malloc(1, 16) != NULL || info.free_bytes != 0 || info.unused != 0) {
+        p("Short bank has %u free bytes, %u unused\r\n", info.free_bytes, info.unused);
+        return -1;
+    }
+
+    /* The full bank keeps its heap in the upper sector. */
+    ptr = xmem_malloc(0, 1000);
+    if (ptr == NULL || XMEM_ADDR(ptr) < XMEM_SECTOR_BOUNDARY) {
+        p("Full bank allocated at 0x%x\r\n", XMEM_ADDR(ptr));
+        return -1;
+    }
+    xmem_free(0, ptr);
+
+    xmem_init();
+
+    p("Short upper bank test successful\r\n");
+
+    return 0;
+}
+#endif
+
+int main (void) {
+    int failed = 0;
+
+    xmem_host_reset();
+#if XMEM_RUNTIME_CONFIG
+    {
+        /* Start on a single bank so xmem_init has to make room for more state. */
+        struct xmem_config config = { 65536, NULL, 0, 0 };
+
+        xmem_init_ex(&config);
+    }
+#endif
+    xmem_init();
+
+    p("Running tests...\r\n");
+
+    failed |= test_memory_access();
+    failed |= test_low_memory_access();
+    failed |= test_bank_select();
+#if !XMEM_NATIVE_MALLOC
+    failed |= test_heap_location();
+#endif
+    failed |= test_reinit();
+    failed |= test_sectors();
+    failed |= test_calibrate();
+    failed |= test_fill();
+    failed |= test_xmem_malloc();
+    failed |= test_xmem_pool();
+    failed |= test_far_pointers();
+    failed |= test_memcpy_far();
+    failed |= test_isr_bank();
+    failed |= test_switch_inline();
+    failed |= test_cache();
+    failed |= test_stats();
+    failed |= test_handles();
+    failed |= test_low_heap();
+    failed |= test_probe();
+#if XMEM_COMMON_END
+    failed |= test_common();
+#endif
+    failed |= test_vm();
+    failed |= test_ring();
+    failed |= test_pingpong();
+    failed |= test_stream();
+    failed |= test_memtest();
+#if XMEM_LAZY_BANK_INIT
+    failed |= test_lazy_banks();
+#endif
+#if XMEM_RUNTIME_CONFIG && XMEM_HEAP_SECTOR == XMEM_SECTOR_UPPER && XMEM_SECTOR_LIMIT
+    failed |= test_short_upper_bank();
+#endif
+
+    p("Ran tests...\r\n");
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}